@@ -0,0 +1,360 @@
+/*
+ * alarm_loadgen.c
+ *
+ * Synthetic load generator for new_alarm_mutex.c. It writes a
+ * stream of Start_Alarm, Change_Alarm, Cancel_Alarm and View_Alarms
+ * commands, in exactly the grammar that the alarm program's main
+ * thread parses, to stdout, a file or a socket. Commands are paced
+ * to a target rate following one of several arrival processes, so
+ * that realistic traffic shapes can be replayed against the engine.
+ *
+ * Change and Cancel commands only ever name alarms that this
+ * generator has started and not yet cancelled (they may of course
+ * have expired in the engine by the time they arrive).
+ */
+#include <time.h>
+#include <math.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include "errors.h"
+
+/*
+ * Arrival processes:
+ *   poisson  exponential inter-arrival gaps with mean 1/rate
+ *   bursty   groups of burst_size back-to-back commands, with
+ *            exponential gaps between groups so the mean rate holds
+ *   diurnal  Poisson with a rate that swings sinusoidally around
+ *            the target over period seconds (generated by thinning)
+ */
+typedef enum { ARRIVAL_POISSON, ARRIVAL_BURSTY, ARRIVAL_DIURNAL } arrival_t;
+
+/*
+ * Alarm duration distributions, given as "kind:param[:param]":
+ *   fixed:N, uniform:MIN:MAX, exp:MEAN, pareto:MIN:ALPHA
+ */
+typedef enum { DURATION_FIXED, DURATION_UNIFORM, DURATION_EXP, DURATION_PARETO } duration_kind_t;
+
+typedef struct duration_tag {
+    duration_kind_t     kind;
+    double              a;
+    double              b;
+} duration_t;
+
+static uint64_t rng_state = 88172645463325252ULL;
+
+/*
+ * xorshift64* -- small, fast and, unlike rand(), identical on every
+ * platform for a given seed, so a run can be reproduced with -S.
+ */
+static double rng_uniform (void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return ((rng_state * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double rng_exp (double mean)
+{
+    return -mean * log (1.0 - rng_uniform ());
+}
+
+static int draw_duration (const duration_t *d)
+{
+    double value;
+
+    switch (d->kind) {
+    case DURATION_UNIFORM:
+        value = d->a + rng_uniform () * (d->b - d->a + 1);
+        break;
+    case DURATION_EXP:
+        value = rng_exp (d->a);
+        break;
+    case DURATION_PARETO:
+        value = d->a / pow (1.0 - rng_uniform (), 1.0 / d->b);
+        break;
+    default:
+        value = d->a;
+        break;
+    }
+    if (value < 1)
+        value = 1;
+    if (value > 2000000000)
+        value = 2000000000;
+    return (int)value;
+}
+
+static int parse_duration (const char *text, duration_t *d)
+{
+    d->a = d->b = 0;
+    if (sscanf (text, "fixed:%lf", &d->a) == 1)
+        d->kind = DURATION_FIXED;
+    else if (sscanf (text, "uniform:%lf:%lf", &d->a, &d->b) == 2 && d->b >= d->a)
+        d->kind = DURATION_UNIFORM;
+    else if (sscanf (text, "exp:%lf", &d->a) == 1)
+        d->kind = DURATION_EXP;
+    else if (sscanf (text, "pareto:%lf:%lf", &d->a, &d->b) == 2 && d->b > 0)
+        d->kind = DURATION_PARETO;
+    else
+        return -1;
+    return d->a > 0 ? 0 : -1;
+}
+
+/*
+ * Type names are two characters, the most the engine's type[3]
+ * field holds: "A0" .. "Z9", "AA" ... for up to 26 * 36 types.
+ */
+static void type_name (int index, char *name)
+{
+    static const char alnum[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+    name[0] = 'A' + index / 36;
+    name[1] = alnum[index % 36];
+    name[2] = '\0';
+}
+
+/*
+ * Open the output: "-" for stdout, "unix:PATH" or "tcp:HOST:PORT"
+ * for a stream socket, anything else is a file name.
+ */
+static FILE *open_output (const char *target)
+{
+    int fd = -1;
+
+    if (strcmp (target, "-") == 0)
+        return stdout;
+
+    if (strncmp (target, "unix:", 5) == 0) {
+        struct sockaddr_un addr;
+
+        memset (&addr, 0, sizeof (addr));
+        addr.sun_family = AF_UNIX;
+        strncpy (addr.sun_path, target + 5, sizeof (addr.sun_path) - 1);
+        fd = socket (AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            errno_abort ("Create socket");
+        if (connect (fd, (struct sockaddr *)&addr, sizeof (addr)) < 0)
+            errno_abort ("Connect socket");
+    } else if (strncmp (target, "tcp:", 4) == 0) {
+        char host[256];
+        char *port;
+        struct addrinfo hints, *res, *ai;
+        int status;
+
+        strncpy (host, target + 4, sizeof (host) - 1);
+        host[sizeof (host) - 1] = '\0';
+        port = strrchr (host, ':');
+        if (port == NULL) {
+            fprintf (stderr, "Bad tcp target %s\n", target);
+            exit (1);
+        }
+        *port++ = '\0';
+        memset (&hints, 0, sizeof (hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        status = getaddrinfo (host, port, &hints, &res);
+        if (status != 0) {
+            fprintf (stderr, "Resolve %s: %s\n", target, gai_strerror (status));
+            exit (1);
+        }
+        for (ai = res; ai != NULL; ai = ai->ai_next) {
+            fd = socket (ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (fd < 0)
+                continue;
+            if (connect (fd, ai->ai_addr, ai->ai_addrlen) == 0)
+                break;
+            close (fd);
+            fd = -1;
+        }
+        freeaddrinfo (res);
+        if (fd < 0)
+            errno_abort ("Connect socket");
+    } else {
+        FILE *file = fopen (target, "w");
+
+        if (file == NULL)
+            errno_abort ("Open output");
+        return file;
+    }
+    return fdopen (fd, "w");
+}
+
+static double monotonic_now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void sleep_until (double when)
+{
+    struct timespec ts;
+
+    ts.tv_sec = (time_t)when;
+    ts.tv_nsec = (long)((when - ts.tv_sec) * 1e9);
+    while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+static void usage (const char *name)
+{
+    fprintf (stderr,
+        "Usage: %s [-n count] [-r rate] [-a poisson|bursty|diurnal]\n"
+        "        [-b burst] [-p period] [-A amplitude] [-d duration]\n"
+        "        [-t types] [-c cancel] [-m change] [-w view]\n"
+        "        [-l length] [-i first_id] [-S seed] [-o output]\n",
+        name);
+    exit (1);
+}
+
+int main (int argc, char *argv[])
+{
+    long count = 1000;                  //Commands to emit (0 = forever)
+    double rate = 10;                   //Mean commands per second (0 = unpaced)
+    arrival_t arrival = ARRIVAL_POISSON;
+    int burst = 20;                     //Commands per burst (bursty)
+    double period = 86400;              //Seconds per cycle (diurnal)
+    double amplitude = 0.8;             //Rate swing as a fraction of rate (diurnal)
+    duration_t duration = { DURATION_UNIFORM, 10, 60 };
+    int types = 4;
+    double cancel_ratio = 0.1, change_ratio = 0.1, view_ratio = 0.0;
+    int message_length = 16;
+    int next_id = 1;
+    const char *output = "-";
+    int opt;
+
+    while ((opt = getopt (argc, argv, "n:r:a:b:p:A:d:t:c:m:w:l:i:S:o:")) != -1) {
+        switch (opt) {
+        case 'n': count = atol (optarg); break;
+        case 'r': rate = atof (optarg); break;
+        case 'a':
+            if (strcmp (optarg, "poisson") == 0)
+                arrival = ARRIVAL_POISSON;
+            else if (strcmp (optarg, "bursty") == 0)
+                arrival = ARRIVAL_BURSTY;
+            else if (strcmp (optarg, "diurnal") == 0)
+                arrival = ARRIVAL_DIURNAL;
+            else
+                usage (argv[0]);
+            break;
+        case 'b': burst = atoi (optarg); break;
+        case 'p': period = atof (optarg); break;
+        case 'A': amplitude = atof (optarg); break;
+        case 'd':
+            if (parse_duration (optarg, &duration) != 0)
+                usage (argv[0]);
+            break;
+        case 't': types = atoi (optarg); break;
+        case 'c': cancel_ratio = atof (optarg); break;
+        case 'm': change_ratio = atof (optarg); break;
+        case 'w': view_ratio = atof (optarg); break;
+        case 'l': message_length = atoi (optarg); break;
+        case 'i': next_id = atoi (optarg); break;
+        case 'S': rng_state = strtoull (optarg, NULL, 0) | 1; break;
+        case 'o': output = optarg; break;
+        default: usage (argv[0]);
+        }
+    }
+    if (types < 1 || types > 26 * 36 || burst < 1 || rate < 0
+            || amplitude < 0 || amplitude > 1 || period <= 0
+            || cancel_ratio + change_ratio + view_ratio > 1)
+        usage (argv[0]);
+
+    /*
+     * A command line must survive the engine's 128 character limit:
+     * "Change_Alarm(2147483647): XX 2000000000 " is 40 characters.
+     */
+    if (message_length < 1)
+        message_length = 1;
+    if (message_length > 80)
+        message_length = 80;
+
+    FILE *out = open_output (output);
+    int *live = NULL;                   //IDs started and not yet cancelled
+    long live_count = 0, live_size = 0;
+    long emitted[4] = { 0, 0, 0, 0 };   //start, change, cancel, view
+    double start = monotonic_now ();
+    double when = start;                //Scheduled time of the next command
+    int burst_left = 0;
+
+    for (long n = 0; count == 0 || n < count; n++) {
+        char type[3], message[81];
+        double pick;
+
+        /*
+         * Schedule the next arrival on an absolute timeline, so that
+         * time spent writing does not drift the achieved rate.
+         */
+        if (rate > 0) {
+            switch (arrival) {
+            case ARRIVAL_BURSTY:
+                if (burst_left == 0) {
+                    when += rng_exp (burst / rate);
+                    burst_left = burst;
+                }
+                burst_left--;
+                break;
+            case ARRIVAL_DIURNAL:
+                do
+                    when += rng_exp (1.0 / (rate * (1 + amplitude)));
+                while (rng_uniform () * (1 + amplitude) >
+                    1 + amplitude * sin (2 * M_PI * (when - start) / period));
+                break;
+            default:
+                when += rng_exp (1.0 / rate);
+                break;
+            }
+            if (when > monotonic_now ()) {
+                fflush (out);
+                sleep_until (when);
+            }
+        }
+
+        type_name ((int)(rng_uniform () * types), type);
+        for (int i = 0; i < message_length; i++)
+            message[i] = 'a' + (int)(rng_uniform () * 26);
+        message[message_length] = '\0';
+
+        pick = rng_uniform ();
+        if (live_count > 0 && pick < cancel_ratio) {
+            long victim = (long)(rng_uniform () * live_count);
+
+            fprintf (out, "Cancel_Alarm(%d)\n", live[victim]);
+            live[victim] = live[--live_count];
+            emitted[2]++;
+        } else if (live_count > 0 && pick < cancel_ratio + change_ratio) {
+            fprintf (out, "Change_Alarm(%d): %s %d %s\n",
+                live[(long)(rng_uniform () * live_count)],
+                type, draw_duration (&duration), message);
+            emitted[1]++;
+        } else if (pick < cancel_ratio + change_ratio + view_ratio) {
+            fprintf (out, "View_Alarms\n");
+            emitted[3]++;
+        } else {
+            if (live_count == live_size) {
+                live_size = live_size ? live_size * 2 : 1024;
+                live = realloc (live, live_size * sizeof (int));
+                if (live == NULL)
+                    errno_abort ("Allocate live IDs");
+            }
+            live[live_count++] = next_id;
+            fprintf (out, "Start_Alarm(%d): %s %d %s\n",
+                next_id++, type, draw_duration (&duration), message);
+            emitted[0]++;
+        }
+        if (ferror (out))
+            errno_abort ("Write command");
+    }
+    fflush (out);
+
+    double elapsed = monotonic_now () - start;
+    fprintf (stderr, "Emitted %ld start, %ld change, %ld cancel, %ld view in %.3fs (%.1f/s)\n",
+        emitted[0], emitted[1], emitted[2], emitted[3], elapsed,
+        elapsed > 0 ? (emitted[0] + emitted[1] + emitted[2] + emitted[3]) / elapsed : 0.0);
+    free (live);
+    return 0;
+}
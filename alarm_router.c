@@ -0,0 +1,353 @@
+/*
+ * alarm_router.c
+ *
+ * Partitions alarms across several new_alarm_mutex.c engine
+ * processes, for alarm populations that are too large for one. The
+ * router starts the engines itself, connected by pipes, and reads
+ * commands in the usual "alarm>" grammar from stdin:
+ *
+ *   - Start_Alarm, Change_Alarm and Cancel_Alarm go to the one
+ *     engine that owns the alarm ID, chosen by a hash of the ID or
+ *     by fixed-width ID ranges.
+ *   - View_Alarms and Stats go to every engine; the router collects
+ *     the replies and prints a single merged result.
+ *
+ * Commands may carry a tenant prefix, "name:Command"; it is passed
+ * on to the engines, which keep each tenant separate.
+ *
+ * Everything else the engines print is passed through unchanged.
+ * The engines run with -q, so that they print no prompt and end
+ * each View_Alarms listing with a line the router can recognise.
+ */
+#include <pthread.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include "errors.h"
+
+#define MAX_PARTITIONS  64
+
+typedef struct partition_tag {
+    int                 index;
+    pid_t               pid;
+    FILE                *to;            //Engine's stdin
+    FILE                *from;          //Engine's stdout
+    pthread_t           reader;
+    char                *view;          //View_Alarms reply being collected
+    size_t              view_len;
+    int                 collecting;     //Inside a View_Alarms reply
+} partition_t;
+
+partition_t partitions[MAX_PARTITIONS];
+int partition_count = 4;
+int route_by_range = 0;
+long range_width = 1000000;
+int prefix_output = 0;
+
+/*
+ * Replies to fanned-out commands. The main thread sets pending to
+ * the number of engines, and waits until the readers have brought
+ * it back to zero. Only the fan-out and the reply lines take
+ * fanout_mutex: routed commands and passed-through lines never
+ * wait for it, so an engine is never left blocked on a full pipe
+ * while the thread that would drain it waits for the mutex.
+ */
+pthread_mutex_t fanout_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t fanout_cond = PTHREAD_COND_INITIALIZER;
+int fanout_pending = 0;
+long stats_time;
+long stats_totals[10];                  //Pending, Displays, Started, Changed, Cancelled, Expired, Rejected, Cold, Dropped, Coalesced
+char stats_tenant[16];
+
+pthread_mutex_t output_mutex = PTHREAD_MUTEX_INITIALIZER;   //Keeps output lines whole
+
+/*
+ * Choose the engine that owns an alarm ID.
+ */
+static int route (int alarm_id)
+{
+    if (route_by_range) {
+        long slot = alarm_id < 0 ? 0 : alarm_id / range_width;
+        return slot >= partition_count ? partition_count - 1 : (int)slot;
+    }
+
+    //Mix the bits so that consecutive IDs spread evenly
+    uint32_t x = (uint32_t)alarm_id;
+    x = ((x >> 16) ^ x) * 0x45d9f3bU;
+    x = ((x >> 16) ^ x) * 0x45d9f3bU;
+    x = (x >> 16) ^ x;
+    return (int)(x % (uint32_t)partition_count);
+}
+
+static void fanout_done (void)
+{
+    int status;
+
+    if (--fanout_pending == 0) {
+        status = pthread_cond_signal (&fanout_cond);
+        if (status != 0)
+            err_abort (status, "Signal fan-out");
+    }
+}
+
+/*
+ * The reader thread's start routine: one per engine. Collect
+ * replies to fanned-out commands, and pass everything else through.
+ */
+void *reader_thread (void *arg)
+{
+    partition_t *part = (partition_t *)arg;
+    char line[512], tenant[16];
+    long values[10], when;
+    int stats, status;
+
+    while (fgets (line, sizeof (line), part->from) != NULL) {
+        values[7] = values[8] = values[9] = 0;
+        stats = sscanf (line, "Stats at %ld: Pending %ld Displays %ld Started %ld Changed %ld Cancelled %ld Expired %ld Rejected %ld Tenant %15s Cold %ld Dropped %ld Coalesced %ld",
+                &when, &values[0], &values[1], &values[2], &values[3], &values[4], &values[5], &values[6], tenant, &values[7], &values[8], &values[9]) >= 9;
+
+        //A line that is no part of a reply goes straight out
+        if (!stats && !part->collecting && strncmp (line, "View Alarms at ", 15) != 0) {
+            status = pthread_mutex_lock (&output_mutex);
+            if (status != 0)
+                err_abort (status, "Lock output mutex");
+            if (prefix_output)
+                printf ("[%d] ", part->index);
+            fputs (line, stdout);
+            fflush (stdout);
+            status = pthread_mutex_unlock (&output_mutex);
+            if (status != 0)
+                err_abort (status, "Unlock output mutex");
+            continue;
+        }
+
+        status = pthread_mutex_lock (&fanout_mutex);
+        if (status != 0)
+            err_abort (status, "Lock fan-out mutex");
+        if (stats) {
+            strcpy (stats_tenant, tenant);
+            if (when > stats_time)
+                stats_time = when;
+            for (int i = 0; i < 10; i++)
+                stats_totals[i] += values[i];
+            fanout_done ();
+        } else if (strncmp (line, "View Alarms at ", 15) == 0) {
+            part->collecting = 1;
+            part->view_len = 0;
+        } else if (part->collecting && strcmp (line, "End View Alarms\n") == 0) {
+            part->collecting = 0;
+            fanout_done ();
+        } else {
+            size_t len = strlen (line);
+
+            part->view = realloc (part->view, part->view_len + len + 1);
+            if (part->view == NULL)
+                errno_abort ("Allocate view");
+            memcpy (part->view + part->view_len, line, len + 1);
+            part->view_len += len;
+        }
+        status = pthread_mutex_unlock (&fanout_mutex);
+        if (status != 0)
+            err_abort (status, "Unlock fan-out mutex");
+    }
+
+    //An engine that exits mid-reply must not hang the main thread
+    status = pthread_mutex_lock (&fanout_mutex);
+    if (status != 0)
+        err_abort (status, "Lock fan-out mutex");
+    if (part->collecting) {
+        part->collecting = 0;
+        fanout_done ();
+    }
+    status = pthread_mutex_unlock (&fanout_mutex);
+    if (status != 0)
+        err_abort (status, "Unlock fan-out mutex");
+    return NULL;
+}
+
+/*
+ * Start an engine with its stdin and stdout connected to pipes.
+ */
+static void spawn_engine (partition_t *part, char *argv[])
+{
+    int to_pipe[2], from_pipe[2];
+    int status;
+
+    if (pipe (to_pipe) < 0 || pipe (from_pipe) < 0)
+        errno_abort ("Create pipe");
+
+    //Keep other engines' pipes out of this one, or they never see EOF
+    fcntl (to_pipe[1], F_SETFD, FD_CLOEXEC);
+    fcntl (from_pipe[0], F_SETFD, FD_CLOEXEC);
+    part->pid = fork ();
+    if (part->pid < 0)
+        errno_abort ("Fork engine");
+    if (part->pid == 0) {
+        dup2 (to_pipe[0], STDIN_FILENO);
+        dup2 (from_pipe[1], STDOUT_FILENO);
+        execvp (argv[0], argv);
+        fprintf (stderr, "Start engine %s: %s\n", argv[0], strerror (errno));
+        _exit (127);
+    }
+    close (to_pipe[0]);
+    close (from_pipe[1]);
+    part->to = fdopen (to_pipe[1], "w");
+    part->from = fdopen (from_pipe[0], "r");
+    if (part->to == NULL || part->from == NULL)
+        errno_abort ("Open engine pipe");
+
+    status = pthread_create (&part->reader, NULL, reader_thread, part);
+    if (status != 0)
+        err_abort (status, "Create reader thread");
+}
+
+static void flush_engines (void)
+{
+    for (int i = 0; i < partition_count; i++)
+        fflush (partitions[i].to);
+}
+
+/*
+ * Send a command to every engine and wait for all the replies.
+ * Called with fanout_mutex held.
+ */
+static void fan_out (const char *line)
+{
+    int status;
+
+    fanout_pending = partition_count;
+    for (int i = 0; i < partition_count; i++)
+        fputs (line, partitions[i].to);
+    flush_engines ();
+    while (fanout_pending > 0) {
+        status = pthread_cond_wait (&fanout_cond, &fanout_mutex);
+        if (status != 0)
+            err_abort (status, "Wait for fan-out");
+    }
+}
+
+static void usage (const char *name)
+{
+    fprintf (stderr,
+        "Usage: %s [-n partitions] [-m hash|range] [-w width] [-p]\n"
+        "        [-e engine] [-- engine options]\n", name);
+    exit (1);
+}
+
+int main (int argc, char *argv[])
+{
+    char *engine = "./new_alarm_mutex";
+    char *engine_argv[64];
+    int engine_argc = 0;
+    char line[256], command[16], *text;
+    struct pollfd input = { STDIN_FILENO, POLLIN, 0 };
+    int alarm_id, opt, status;
+
+    while ((opt = getopt (argc, argv, "n:m:w:pe:")) != -1) {
+        switch (opt) {
+        case 'n': partition_count = atoi (optarg); break;
+        case 'm':
+            if (strcmp (optarg, "hash") == 0)
+                route_by_range = 0;
+            else if (strcmp (optarg, "range") == 0)
+                route_by_range = 1;
+            else
+                usage (argv[0]);
+            break;
+        case 'w': range_width = atol (optarg); break;
+        case 'p': prefix_output = 1; break;
+        case 'e': engine = optarg; break;
+        default: usage (argv[0]);
+        }
+    }
+    if (partition_count < 1 || partition_count > MAX_PARTITIONS || range_width < 1
+            || argc - optind > 60)
+        usage (argv[0]);
+
+    //Everything after "--" is passed to each engine
+    engine_argv[engine_argc++] = engine;
+    engine_argv[engine_argc++] = "-q";
+    while (optind < argc)
+        engine_argv[engine_argc++] = argv[optind++];
+    engine_argv[engine_argc] = NULL;
+
+    for (int i = 0; i < partition_count; i++) {
+        partitions[i].index = i;
+        spawn_engine (&partitions[i], engine_argv);
+    }
+
+    while (1) {
+        //Batch writes to the engines while input keeps coming
+        if (poll (&input, 1, 0) == 0)
+            flush_engines ();
+        if (fgets (line, sizeof (line), stdin) == NULL)
+            break;
+        if (strlen (line) <= 1)
+            continue;
+
+        //Look past a tenant prefix, "name:Command"
+        text = line + strspn (line, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_-");
+        text = *text == ':' ? text + 1 : line;
+
+        if (strcmp (text, "View_Alarms\n") == 0) {
+            status = pthread_mutex_lock (&fanout_mutex);
+            if (status != 0)
+                err_abort (status, "Lock fan-out mutex");
+            fan_out (line);
+            status = pthread_mutex_lock (&output_mutex);
+            if (status != 0)
+                err_abort (status, "Lock output mutex");
+            printf ("View Alarms across %d partitions:\n", partition_count);
+            for (int i = 0; i < partition_count; i++) {
+                printf ("Partition %d:\n", i);
+                if (partitions[i].view_len > 0)
+                    fputs (partitions[i].view, stdout);
+                partitions[i].view_len = 0;
+            }
+            fflush (stdout);
+            status = pthread_mutex_unlock (&output_mutex);
+            if (status != 0)
+                err_abort (status, "Unlock output mutex");
+            status = pthread_mutex_unlock (&fanout_mutex);
+            if (status != 0)
+                err_abort (status, "Unlock fan-out mutex");
+        } else if (strcmp (text, "Stats\n") == 0) {
+            status = pthread_mutex_lock (&fanout_mutex);
+            if (status != 0)
+                err_abort (status, "Lock fan-out mutex");
+            stats_time = 0;
+            memset (stats_totals, 0, sizeof (stats_totals));
+            fan_out (line);
+            status = pthread_mutex_lock (&output_mutex);
+            if (status != 0)
+                err_abort (status, "Lock output mutex");
+            printf ("Stats at %ld: Pending %ld Displays %ld Started %ld Changed %ld Cancelled %ld Expired %ld Rejected %ld Tenant %s Cold %ld Dropped %ld Coalesced %ld Partitions %d\n",
+                stats_time, stats_totals[0], stats_totals[1], stats_totals[2],
+                stats_totals[3], stats_totals[4], stats_totals[5], stats_totals[6],
+                stats_tenant, stats_totals[7], stats_totals[8], stats_totals[9], partition_count);
+            fflush (stdout);
+            status = pthread_mutex_unlock (&output_mutex);
+            if (status != 0)
+                err_abort (status, "Unlock output mutex");
+            status = pthread_mutex_unlock (&fanout_mutex);
+            if (status != 0)
+                err_abort (status, "Unlock fan-out mutex");
+        } else if (sscanf (text, "%15[^(](%d)", command, &alarm_id) == 2) {
+            fputs (line, partitions[route (alarm_id)].to);
+        } else {
+            //Let an engine report the error in its usual words
+            fputs (line, partitions[0].to);
+        }
+    }
+
+    //End of input: close every engine's stdin and wait for them
+    for (int i = 0; i < partition_count; i++)
+        fclose (partitions[i].to);
+    for (int i = 0; i < partition_count; i++) {
+        waitpid (partitions[i].pid, NULL, 0);
+        pthread_join (partitions[i].reader, NULL);
+    }
+    return 0;
+}
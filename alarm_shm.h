@@ -0,0 +1,298 @@
+#ifndef __alarm_shm_h
+#define __alarm_shm_h
+
+/*
+ * alarm_shm.h
+ *
+ * Shared memory interface to the new_alarm_mutex.c engine, for
+ * processes on the same host that need alarms without running an
+ * engine (and its threads) of their own.
+ *
+ * The engine, started with "-s name", creates the POSIX shared
+ * memory object "name" holding one submission ring and a set of
+ * client slots, each with its own completion ring:
+ *
+ *   - clients claim a slot with alarm_shm_attach(), then push binary
+ *     Start, Change and Cancel records into the submission ring with
+ *     alarm_shm_submit(). The ring is multi-producer, so any number
+ *     of client processes (and threads) can submit concurrently.
+ *   - the engine pops submissions and carries them out exactly like
+ *     commands typed at the "alarm>" prompt. When an alarm that came
+ *     from a slot expires or is cancelled, or a submission is
+ *     rejected, the engine pushes a completion record into that
+ *     slot's completion ring, read with alarm_shm_complete().
+ *
+ * Both directions are bounded lock-free queues (one sequence number
+ * per cell, after Dmitry Vyukov's MPMC queue), so neither side takes
+ * a lock or makes a system call on the fast path. A consumer that
+ * finds its ring empty sleeps on a futex word in the ring, which the
+ * producer bumps and wakes only when somebody is actually waiting.
+ * Elsewhere than Linux the wait degrades to a short polling sleep.
+ */
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+# include <linux/futex.h>
+# include <sys/syscall.h>
+#endif
+#include "errors.h"
+
+#define ALARM_SHM_MAGIC         0x414c524dU     /* "ALRM" */
+#define ALARM_SHM_VERSION       2
+#define ALARM_SHM_SUBMIT_CELLS  4096            /* Power of two */
+#define ALARM_SHM_COMPLETE_CELLS 1024           /* Power of two */
+#define ALARM_SHM_CLIENTS       16
+
+/*
+ * Record operations. Submissions use START, CHANGE and CANCEL;
+ * completions use EXPIRED, CANCELLED and REJECTED. A REJECTED
+ * completion keeps the rest of the submission as it was, and gives
+ * the submission's own op in request.
+ */
+#define ALARM_SHM_START         1
+#define ALARM_SHM_CHANGE        2
+#define ALARM_SHM_CANCEL        3
+#define ALARM_SHM_EXPIRED       4
+#define ALARM_SHM_CANCELLED     5
+#define ALARM_SHM_REJECTED      6
+
+typedef struct alarm_shm_record_tag {
+    uint32_t            op;
+    uint32_t            request;        /* REJECTED: the submission's op */
+    int32_t             client;         /* Submitting slot */
+    int32_t             alarm_ID;
+    int32_t             seconds;
+    int64_t             time;           /* Completions: engine time */
+    char                type[3];
+    char                message[128];
+} alarm_shm_record_t;
+
+typedef struct alarm_shm_cell_tag {
+    _Atomic uint64_t    sequence;
+    alarm_shm_record_t  record;
+} alarm_shm_cell_t;
+
+/*
+ * Ring header. The producer and consumer cursors, and the futex
+ * word, each get a cache line of their own so that producers and
+ * the consumer do not false-share.
+ */
+typedef struct alarm_shm_ring_tag {
+    _Alignas(64) _Atomic uint64_t tail;         /* Next cell to produce */
+    _Alignas(64) _Atomic uint64_t head;         /* Next cell to consume */
+    _Alignas(64) _Atomic uint32_t futex;        /* Bumped on every push */
+    _Atomic uint32_t    waiters;
+    uint32_t            mask;
+    _Atomic uint32_t    dropped;                /* Pushes refused: ring full */
+} alarm_shm_ring_t;
+
+typedef struct alarm_shm_client_tag {
+    _Atomic int32_t     owner;                  /* pid, or 0 if free */
+    alarm_shm_ring_t    ring;
+    alarm_shm_cell_t    cells[ALARM_SHM_COMPLETE_CELLS];
+} alarm_shm_client_t;
+
+typedef struct alarm_shm_tag {
+    uint32_t            magic;
+    uint32_t            version;
+    alarm_shm_ring_t    submit;
+    alarm_shm_cell_t    submit_cells[ALARM_SHM_SUBMIT_CELLS];
+    alarm_shm_client_t  clients[ALARM_SHM_CLIENTS];
+} alarm_shm_t;
+
+static inline void alarm_shm_ring_init (alarm_shm_ring_t *ring, alarm_shm_cell_t *cells, uint32_t count)
+{
+    atomic_init (&ring->tail, 0);
+    atomic_init (&ring->head, 0);
+    atomic_init (&ring->futex, 0);
+    atomic_init (&ring->waiters, 0);
+    atomic_init (&ring->dropped, 0);
+    ring->mask = count - 1;
+    for (uint32_t i = 0; i < count; i++)
+        atomic_init (&cells[i].sequence, i);
+}
+
+/*
+ * Push a record. Returns 0, or -1 if the ring is full.
+ */
+static inline int alarm_shm_push (alarm_shm_ring_t *ring, alarm_shm_cell_t *cells, const alarm_shm_record_t *record)
+{
+    uint64_t pos = atomic_load_explicit (&ring->tail, memory_order_relaxed);
+    alarm_shm_cell_t *cell;
+
+    for (;;) {
+        cell = &cells[pos & ring->mask];
+        uint64_t seq = atomic_load_explicit (&cell->sequence, memory_order_acquire);
+        int64_t diff = (int64_t)(seq - pos);
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit (&ring->tail, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            atomic_fetch_add_explicit (&ring->dropped, 1, memory_order_relaxed);
+            return -1;
+        } else
+            pos = atomic_load_explicit (&ring->tail, memory_order_relaxed);
+    }
+    cell->record = *record;
+    atomic_store_explicit (&cell->sequence, pos + 1, memory_order_release);
+
+    atomic_fetch_add_explicit (&ring->futex, 1, memory_order_seq_cst);
+    if (atomic_load_explicit (&ring->waiters, memory_order_seq_cst) != 0) {
+#ifdef __linux__
+        syscall (SYS_futex, &ring->futex, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+#endif
+    }
+    return 0;
+}
+
+/*
+ * Pop a record. Returns 0, or -1 if the ring is empty.
+ */
+static inline int alarm_shm_pop (alarm_shm_ring_t *ring, alarm_shm_cell_t *cells, alarm_shm_record_t *record)
+{
+    uint64_t pos = atomic_load_explicit (&ring->head, memory_order_relaxed);
+    alarm_shm_cell_t *cell;
+
+    for (;;) {
+        cell = &cells[pos & ring->mask];
+        uint64_t seq = atomic_load_explicit (&cell->sequence, memory_order_acquire);
+        int64_t diff = (int64_t)(seq - (pos + 1));
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit (&ring->head, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (diff < 0)
+            return -1;
+        else
+            pos = atomic_load_explicit (&ring->head, memory_order_relaxed);
+    }
+    *record = cell->record;
+    atomic_store_explicit (&cell->sequence, pos + ring->mask + 1, memory_order_release);
+    return 0;
+}
+
+/*
+ * Pop a record, sleeping up to timeout_ms milliseconds for one to
+ * arrive. Returns 0, or -1 on timeout.
+ */
+static inline int alarm_shm_pop_wait (alarm_shm_ring_t *ring, alarm_shm_cell_t *cells, alarm_shm_record_t *record, int timeout_ms)
+{
+    struct timespec timeout;
+
+    if (alarm_shm_pop (ring, cells, record) == 0)
+        return 0;
+
+    /*
+     * Sample the futex word, announce ourselves, and look once more:
+     * a push that lands after the sample changes the word, so the
+     * futex wait returns at once instead of missing the wakeup.
+     */
+    uint32_t seen = atomic_load_explicit (&ring->futex, memory_order_seq_cst);
+    atomic_fetch_add_explicit (&ring->waiters, 1, memory_order_seq_cst);
+    if (alarm_shm_pop (ring, cells, record) == 0) {
+        atomic_fetch_sub_explicit (&ring->waiters, 1, memory_order_seq_cst);
+        return 0;
+    }
+#ifdef __linux__
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+    syscall (SYS_futex, &ring->futex, FUTEX_WAIT, seen, &timeout, NULL, 0);
+#else
+    (void)seen;
+    timeout.tv_sec = 0;
+    timeout.tv_nsec = 1000000L;
+    nanosleep (&timeout, NULL);
+#endif
+    atomic_fetch_sub_explicit (&ring->waiters, 1, memory_order_seq_cst);
+    return alarm_shm_pop (ring, cells, record);
+}
+
+/*
+ * Create (engine) or open (client) the shared memory object.
+ */
+static inline alarm_shm_t *alarm_shm_map (const char *name, int create)
+{
+    alarm_shm_t *shm;
+    int fd;
+
+    fd = shm_open (name, create ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR, 0600);
+    if (fd < 0)
+        return NULL;
+    if (create && ftruncate (fd, sizeof (alarm_shm_t)) < 0) {
+        close (fd);
+        return NULL;
+    }
+    shm = mmap (NULL, sizeof (alarm_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close (fd);
+    if (shm == MAP_FAILED)
+        return NULL;
+
+    if (create) {
+        alarm_shm_ring_init (&shm->submit, shm->submit_cells, ALARM_SHM_SUBMIT_CELLS);
+        for (int i = 0; i < ALARM_SHM_CLIENTS; i++) {
+            atomic_init (&shm->clients[i].owner, 0);
+            alarm_shm_ring_init (&shm->clients[i].ring, shm->clients[i].cells, ALARM_SHM_COMPLETE_CELLS);
+        }
+        shm->version = ALARM_SHM_VERSION;
+        atomic_thread_fence (memory_order_release);
+        shm->magic = ALARM_SHM_MAGIC;
+    } else if (shm->magic != ALARM_SHM_MAGIC || shm->version != ALARM_SHM_VERSION) {
+        munmap (shm, sizeof (alarm_shm_t));
+        errno = EPROTO;
+        return NULL;
+    }
+    return shm;
+}
+
+/*
+ * Client side: open the engine's shared memory and claim a client
+ * slot. Slots whose owner process has died are reclaimed (their
+ * completion ring is drained first). Returns the slot, or -1.
+ */
+static inline int alarm_shm_attach (alarm_shm_t *shm)
+{
+    int32_t me = (int32_t)getpid ();
+    alarm_shm_record_t stale;
+
+    for (int i = 0; i < ALARM_SHM_CLIENTS; i++) {
+        alarm_shm_client_t *client = &shm->clients[i];
+        int32_t owner = atomic_load (&client->owner);
+
+        if (owner != 0 && kill (owner, 0) == 0)
+            continue;
+        if (atomic_compare_exchange_strong (&client->owner, &owner, me)) {
+            while (alarm_shm_pop (&client->ring, client->cells, &stale) == 0)
+                ;
+            return i;
+        }
+    }
+    return -1;
+}
+
+static inline void alarm_shm_detach (alarm_shm_t *shm, int slot)
+{
+    atomic_store (&shm->clients[slot].owner, 0);
+}
+
+static inline int alarm_shm_submit (alarm_shm_t *shm, int slot, alarm_shm_record_t *record)
+{
+    record->client = slot;
+    return alarm_shm_push (&shm->submit, shm->submit_cells, record);
+}
+
+static inline int alarm_shm_complete (alarm_shm_t *shm, int slot, alarm_shm_record_t *record, int timeout_ms)
+{
+    alarm_shm_client_t *client = &shm->clients[slot];
+
+    return alarm_shm_pop_wait (&client->ring, client->cells, record, timeout_ms);
+}
+
+#endif
@@ -0,0 +1,118 @@
+/*
+ * alarm_shm_client.c
+ *
+ * Example client for the shared memory interface of new_alarm_mutex.c
+ * (see alarm_shm.h). It reads Start_Alarm, Change_Alarm and
+ * Cancel_Alarm commands from stdin, in the same grammar as the
+ * "alarm>" prompt, submits them to an engine started with
+ * "-s name", and prints the completions the engine sends back.
+ *
+ * At end of input the client keeps waiting until every alarm it
+ * started has expired, been cancelled or been rejected.
+ */
+#include <pthread.h>
+#include "alarm_shm.h"
+
+alarm_shm_t *shm;
+int slot;
+_Atomic long outstanding = 0;           //Alarms started but not completed or rejected
+
+/*
+ * The completion thread's start routine: print each completion
+ * as it arrives.
+ */
+void *completion_thread (void *arg)
+{
+    alarm_shm_record_t record;
+    static const char *names[] = {
+        "", "Start", "Change", "Cancel", "Expired", "Cancelled", "Rejected"
+    };
+
+    while (1) {
+        if (alarm_shm_complete (shm, slot, &record, 1000) != 0)
+            continue;
+        if (record.op == ALARM_SHM_REJECTED)
+            printf ("Alarm(%d) %s %s at %lld: %s %d %s\n", record.alarm_ID,
+                record.request <= ALARM_SHM_CANCEL ? names[record.request] : "?",
+                names[record.op], (long long)record.time, record.type,
+                record.seconds, record.message);
+        else
+            printf ("Alarm(%d) %s at %lld: %s %d %s\n", record.alarm_ID,
+                record.op <= ALARM_SHM_REJECTED ? names[record.op] : "?",
+                (long long)record.time, record.type, record.seconds, record.message);
+        fflush (stdout);
+        if (record.op == ALARM_SHM_EXPIRED || record.op == ALARM_SHM_CANCELLED
+                || (record.op == ALARM_SHM_REJECTED && record.request == ALARM_SHM_START))
+            outstanding--;
+    }
+}
+
+int main (int argc, char *argv[])
+{
+    alarm_shm_record_t record;
+    struct timespec pause;
+    char line[256], command[16];
+    pthread_t thread;
+    int status;
+
+    if (argc != 2) {
+        fprintf (stderr, "Usage: %s shm_name\n", argv[0]);
+        exit (1);
+    }
+    shm = alarm_shm_map (argv[1], 0);
+    if (shm == NULL)
+        errno_abort ("Open shared memory");
+    slot = alarm_shm_attach (shm);
+    if (slot < 0) {
+        fprintf (stderr, "No free client slot in %s\n", argv[1]);
+        exit (1);
+    }
+
+    status = pthread_create (&thread, NULL, completion_thread, NULL);
+    if (status != 0)
+        err_abort (status, "Create completion thread");
+
+    while (fgets (line, sizeof (line), stdin) != NULL) {
+        memset (&record, 0, sizeof (record));
+        if (sscanf (line, "%15[^(](%d): %2s %d %127[^\n]", command,
+                &record.alarm_ID, record.type, &record.seconds, record.message) < 2) {
+            fprintf (stderr, "Bad command\n");
+            continue;
+        }
+        if (strcmp (command, "Start_Alarm") == 0)
+            record.op = ALARM_SHM_START;
+        else if (strcmp (command, "Change_Alarm") == 0)
+            record.op = ALARM_SHM_CHANGE;
+        else if (strcmp (command, "Cancel_Alarm") == 0)
+            record.op = ALARM_SHM_CANCEL;
+        else {
+            fprintf (stderr, "Bad command %s\n", command);
+            continue;
+        }
+
+        /*
+         * Count a Start before it is submitted, so that its
+         * completion can never arrive first.
+         */
+        if (record.op == ALARM_SHM_START)
+            outstanding++;
+
+        /*
+         * The submission ring is bounded: if the engine is behind,
+         * sleep and try again, doubling the pause each time up to
+         * about 10 milliseconds.
+         */
+        pause.tv_sec = 0;
+        pause.tv_nsec = 1000;
+        while (alarm_shm_submit (shm, slot, &record) != 0) {
+            nanosleep (&pause, NULL);
+            if (pause.tv_nsec < 10000000)
+                pause.tv_nsec *= 2;
+        }
+    }
+
+    while (outstanding > 0)
+        sleep (1);
+    alarm_shm_detach (shm, slot);
+    return 0;
+}
@@ -0,0 +1,106 @@
+/*
+ * deadline_bench.c
+ *
+ * Microbenchmark for deadline_scan.h. It fills an array with 32-bit
+ * deadlines, a given fraction of them due, and times each version of
+ * deadline_scan() that this CPU can run over the whole array, 64 keys
+ * per call as the alarm thread does. Every version's masks are also
+ * checked against the scalar version's.
+ */
+#include <time.h>
+#include <getopt.h>
+#include "errors.h"
+#include "deadline_scan.h"
+
+static double now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * Scan the whole array once. The popcount of the masks is returned
+ * so that the compiler cannot drop the work.
+ */
+static long scan_all (deadline_scan_t scan, const uint32_t *keys, long count, uint32_t now)
+{
+    long due = 0;
+
+    for (long i = 0; i < count; i += DEADLINE_SCAN_MAX) {
+        int block = count - i < DEADLINE_SCAN_MAX ? (int)(count - i) : DEADLINE_SCAN_MAX;
+        due += __builtin_popcountll (scan (keys + i, block, now));
+    }
+    return due;
+}
+
+int main (int argc, char *argv[])
+{
+    static const char *names[] = { "scalar", "sse4.1", "avx2" };
+    long count = 1000000, rounds = 200, expected = 0;
+    double fraction = 0.01, scalar_ns = 0;
+    uint32_t now = 1000000;
+    uint32_t *keys;
+    int opt;
+
+    while ((opt = getopt (argc, argv, "n:r:f:")) != -1) {
+        switch (opt) {
+        case 'n': count = atol (optarg); break;
+        case 'r': rounds = atol (optarg); break;
+        case 'f': fraction = atof (optarg); break;
+        default:
+            fprintf (stderr, "Usage: %s [-n keys] [-r rounds] [-f due_fraction]\n", argv[0]);
+            exit (1);
+        }
+    }
+    if (count < 1 || rounds < 1)
+        exit (1);
+
+    keys = malloc (count * sizeof (uint32_t));
+    if (keys == NULL)
+        errno_abort ("Allocate keys");
+    srand (1);
+    for (long i = 0; i < count; i++) {
+        if (rand () < fraction * RAND_MAX)
+            keys[i] = now - rand () % 1000;
+        else
+            keys[i] = now + 1 + rand () % 100000;
+    }
+
+    printf ("%ld keys, %.2f%% due, %ld rounds\n", count, fraction * 100, rounds);
+    for (int v = 0; v < 3; v++) {
+        deadline_scan_t scan = deadline_scan_select (names[v]);
+        long due = 0;
+
+        if (scan == NULL) {
+            printf ("%-8s not supported by this CPU\n", names[v]);
+            continue;
+        }
+
+        //Check every mask against the scalar version first
+        for (long i = 0; i < count; i += DEADLINE_SCAN_MAX) {
+            int block = count - i < DEADLINE_SCAN_MAX ? (int)(count - i) : DEADLINE_SCAN_MAX;
+            if (scan (keys + i, block, now) != deadline_scan_scalar (keys + i, block, now)) {
+                fprintf (stderr, "%s: wrong mask at key %ld\n", names[v], i);
+                exit (1);
+            }
+        }
+
+        double start = now_ns ();
+        for (long r = 0; r < rounds; r++)
+            due += scan_all (scan, keys, count, now);
+        double ns = (now_ns () - start) / ((double)rounds * count);
+
+        if (v == 0) {
+            scalar_ns = ns;
+            expected = due;
+        } else if (due != expected) {
+            fprintf (stderr, "%s: %ld due, expected %ld\n", names[v], due, expected);
+            exit (1);
+        }
+        printf ("%-8s %.3f ns/key  %.2fx scalar\n", names[v], ns, scalar_ns / ns);
+    }
+    free (keys);
+    return 0;
+}
@@ -0,0 +1,108 @@
+#ifndef __deadline_scan_h
+#define __deadline_scan_h
+
+/*
+ * deadline_scan.h
+ *
+ * Find the due entries in a contiguous array of 32-bit deadlines.
+ * deadline_scan(keys, count, now) compares up to 64 keys against now
+ * and returns a mask with bit i set when keys[i] <= now, so that the
+ * caller visits only the entries that are due and skips the rest a
+ * whole block at a time.
+ *
+ * There is a scalar version and, on x86, SSE4.1 and AVX2 versions
+ * that compare 4 and 8 keys per instruction. deadline_scan_select()
+ * picks the best one the CPU supports, once, at startup; the vector
+ * versions are compiled for their instruction set whatever the
+ * compiler flags, and only ever called on a CPU that has it.
+ *
+ * Comparisons are unsigned: key <= now exactly when min(key, now)
+ * equals key, which SSE4.1 and AVX2 can test directly.
+ */
+#include <stdint.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+# define DEADLINE_SCAN_X86      1
+#endif
+
+#define DEADLINE_SCAN_MAX       64      /* Keys per call, at most */
+
+typedef uint64_t (*deadline_scan_t) (const uint32_t *keys, int count, uint32_t now);
+
+static inline uint64_t deadline_scan_scalar (const uint32_t *keys, int count, uint32_t now)
+{
+    uint64_t mask = 0;
+
+    for (int i = 0; i < count; i++)
+        mask |= (uint64_t)(keys[i] <= now) << i;
+    return mask;
+}
+
+#ifdef DEADLINE_SCAN_X86
+__attribute__ ((target ("sse4.1")))
+static uint64_t deadline_scan_sse41 (const uint32_t *keys, int count, uint32_t now)
+{
+    __m128i limit = _mm_set1_epi32 ((int)now);
+    uint64_t mask = 0;
+    int i;
+
+    for (i = 0; i + 4 <= count; i += 4) {
+        __m128i key = _mm_loadu_si128 ((const __m128i *)(keys + i));
+        __m128i due = _mm_cmpeq_epi32 (_mm_min_epu32 (key, limit), key);
+        mask |= (uint64_t)_mm_movemask_ps (_mm_castsi128_ps (due)) << i;
+    }
+    for (; i < count; i++)
+        mask |= (uint64_t)(keys[i] <= now) << i;
+    return mask;
+}
+
+__attribute__ ((target ("avx2")))
+static uint64_t deadline_scan_avx2 (const uint32_t *keys, int count, uint32_t now)
+{
+    __m256i limit = _mm256_set1_epi32 ((int)now);
+    uint64_t mask = 0;
+    int i;
+
+    for (i = 0; i + 8 <= count; i += 8) {
+        __m256i key = _mm256_loadu_si256 ((const __m256i *)(keys + i));
+        __m256i due = _mm256_cmpeq_epi32 (_mm256_min_epu32 (key, limit), key);
+        mask |= (uint64_t)_mm256_movemask_ps (_mm256_castsi256_ps (due)) << i;
+    }
+    for (; i < count; i++)
+        mask |= (uint64_t)(keys[i] <= now) << i;
+    return mask;
+}
+#endif
+
+/*
+ * Pick the fastest version this CPU runs, or a named one ("scalar",
+ * "sse4.1", "avx2") if name is not NULL. Returns NULL for a name the
+ * CPU cannot run.
+ */
+static inline deadline_scan_t deadline_scan_select (const char *name)
+{
+#ifdef DEADLINE_SCAN_X86
+    __builtin_cpu_init ();
+    if ((name == NULL || strcmp (name, "avx2") == 0) && __builtin_cpu_supports ("avx2"))
+        return deadline_scan_avx2;
+    if ((name == NULL || strcmp (name, "sse4.1") == 0) && __builtin_cpu_supports ("sse4.1"))
+        return deadline_scan_sse41;
+#endif
+    if (name == NULL || strcmp (name, "scalar") == 0)
+        return deadline_scan_scalar;
+    return NULL;
+}
+
+static inline const char *deadline_scan_name (deadline_scan_t scan)
+{
+#ifdef DEADLINE_SCAN_X86
+    if (scan == deadline_scan_avx2)
+        return "avx2";
+    if (scan == deadline_scan_sse41)
+        return "sse4.1";
+#endif
+    return "scalar";
+}
+
+#endif
@@ -15,8 +15,18 @@
 #include "errors.h"
 #include <stdio.h>      // Added libraries (Arthi S)
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 #include <unistd.h>     //Added libraries (Hien L)
+#include <getopt.h>
+#include <stdatomic.h>
+#include <stdarg.h>
+#include <assert.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include "alarm_shm.h"
+#include "deadline_scan.h"
 
 /*
  * The "alarm" structure now contains the alarm ID for each alarm, 
@@ -25,516 +35,4846 @@
  * been on the list.
  */
 typedef struct alarm_tag {
-    struct alarm_tag    *link;
     int                 seconds;
-    time_t              time;   /* seconds from EPOCH */
+    time_t              time;   /* seconds from EPOCH (or virtual time, see clock_now) */
     char                message[128];   // Updated to allow 128 characters per message (Arthi S)
     char                type[3];
     int                 alarm_ID;
-    int                 is_assigned;
+    int                 client;         // Shared memory client slot, or -1 (see alarm_shm.h)
+    _Atomic int         state;          // ALARM_PENDING ... ALARM_FREED, changed by CAS only
+    _Atomic int         refs;           // References held by the hot array, the index and a display
+    struct alarm_tag    *index_link;    // Next alarm in the same ID index bucket, or once cancelled, in tenant->cancelled
+    uint64_t            handle;         // Generation << 32 | handle slot, while in the index
+    struct tenant_tag   *tenant;        // Namespace the alarm belongs to
+    _Atomic int         revision;       // Bumped by each Change_Alarm (see display_line_t)
 } alarm_t;
 
+/*
+ * Alarm states. An alarm starts PENDING, becomes ASSIGNED once a
+ * display thread prints it, and ends either FIRING (its time came)
+ * or CANCELLED. Every transition out of PENDING or ASSIGNED is a
+ * compare-and-swap, so when a cancel races with expiry exactly one
+ * of them wins, without either side holding alarm_mutex or
+ * display_mutex to decide it.
+ *
+ * Memory is reclaimed by reference count rather than by whoever
+ * happens to end the alarm: its hot record, the ID index and the
+ * display the alarm is assigned to each hold a reference, and whoever drops
+ * the last one marks the alarm FREED and frees it. So a display
+ * never looks at a freed alarm, however the alarm ended.
+ */
+enum {
+    ALARM_PENDING,
+    ALARM_ASSIGNED,
+    ALARM_FIRING,
+    ALARM_CANCELLED,
+    ALARM_FREED
+};
+
 /*
  * The "display" structure now contains the threadid, type
- * of the display and keep track of its alarms
+ * of the display and keep track of its alarms. Bit k of occupied
+ * is set while assigned_alarm[k] holds an alarm, so a free slot is
+ * found with one ffs() however the slots were emptied.
  */
+#define DISPLAY_SLOTS   2
+#define DISPLAY_FULL    ((1U << DISPLAY_SLOTS) - 1)
+#define MAX_DISPLAYS    10
+#define DISPLAY_PERIOD  5                       //Seconds between periodic prints
+
+/*
+ * Periodic output lines. Everything in a display's periodic line for
+ * an alarm but the time stays the same from one print to the next,
+ * so it is formatted once, when the alarm is assigned (and again
+ * after a Change_Alarm, which bumps the alarm's revision). Each
+ * print then only writes the time into the line, copies the rest
+ * after it, and adds the whole line to the display's output batch
+ * in one copy.
+ */
+typedef struct display_line_tag {
+    char        text[320];                      //Prefix, then the time and the suffix
+    int         prefix;                         //Length of the text before the time
+    char        suffix[176];                    //": type seconds message\n"
+    int         suffix_length;
+    int         revision;                       //Alarm revision the text was made from
+} display_line_t;
+
 typedef struct display_tag {
     pthread_t   threadid;
     char        type[3];
-    int         assigned_alarm_count;
-    alarm_t     *assigned_alarm[2];
+    unsigned    occupied;                       //Bit k: assigned_alarm[k] in use
+    alarm_t     *assigned_alarm[DISPLAY_SLOTS];
+    display_line_t lines[DISPLAY_SLOTS];        //Periodic line for each assigned alarm
+    time_t      next_tick;                      //When the next periodic print is due
+    struct tenant_tag *tenant;
+    int         index;                          //Slot in tenant->display_threads, -1 until published
 } display_t;
 
+/*
+ * The displays of one type, as bitmaps of slots in
+ * tenant->display_threads: all of them, and those with a free slot.
+ * An entry with no displays left is free for another type.
+ */
+typedef struct display_type_tag {
+    char        type[3];
+    unsigned    all;
+    unsigned    free;
+    int         settle;                         //Rebalancer checks this type has been sparse
+} display_type_t;
+
+
+/*
+ * Hot records. The alarm thread's pass over a tenant's alarms reads
+ * only a packed array of these, two or more to a cache line, and
+ * goes to the alarm_t (the "body", with the message and the rest)
+ * only for an alarm that is due, newly started or cancelled. The
+ * array is kept sorted by alarm ID and is protected by alarm_mutex.
+ *
+ * The deadline is in seconds from the tenant's hot_epoch. An alarm's
+ * type never changes after it starts, so both characters are kept
+ * in the record.
+ *
+ * Alongside the records, hot_keys holds one 32-bit key per record:
+ * its deadline, or 0 while the record needs the alarm thread before
+ * then (it is new, or its alarm was cancelled). A pass compares the
+ * keys with the current time a block at a time (see deadline_scan.h)
+ * and looks at only the records whose key has come due.
+ */
+typedef struct hot_tag {
+    uint32_t            deadline;       //Due time, seconds after hot_epoch
+    int32_t             alarm_ID;
+    uint16_t            type;           //type[0] << 8 | type[1]
+    uint16_t            flags;          //HOT_ASSIGNED, HOT_CANCELLED
+    alarm_t             *body;
+} hot_t;
+
+_Static_assert(sizeof(hot_t) <= 32, "hot_t must fit two to a cache line");
+
+#define HOT_ASSIGNED    0x1             //Handed to a display thread (or tried)
+#define HOT_CANCELLED   0x2             //Taken from tenant->cancelled; drop it
+
+deadline_scan_t deadline_scan = deadline_scan_scalar;       //Chosen for the CPU in main()
+
+/*
+ * Alarm handles. Every alarm in the ID index also owns a slot in
+ * handle_slots, and its handle is the slot number with the slot's
+ * generation in the upper 32 bits. The generation changes whenever
+ * the slot is freed, so a handle to an alarm that has since expired
+ * or been cancelled no longer matches, even after the slot is
+ * reused. Looking up a handle is a single array index.
+ */
+typedef struct handle_slot_tag {
+    alarm_t             *alarm;         //NULL while free
+    uint32_t            generation;
+    uint32_t            next_free;
+} handle_slot_t;
+
+#define HANDLE_NONE     UINT32_MAX
+
+int show_handles = 0;                                       //-H: report the handle of each new alarm
+
+/*
+ * Engine-assigned IDs (-D). The engine numbers new alarms itself, so
+ * IDs are dense and unique and the index becomes a paged array
+ * indexed directly by ID instead of a hash table. Each thread that
+ * starts alarms takes IDs from a block of its own, and goes back to
+ * the shared counter only once per DENSE_BLOCK alarms.
+ */
+#define DENSE_BLOCK     64
+#define DENSE_PAGE      1024
+
+int dense_ids = 0;
+_Atomic int dense_next = 1;                                 //First ID of the next free block
+_Thread_local int dense_block_next = 0, dense_block_end = 0;
+
+/*
+ * Tenants. Commands may carry a tenant prefix, "name:Command", and
+ * each tenant is a namespace of its own: alarm IDs, handles, the
+ * alarm list, the alarm thread, the display threads and the
+ * statistics all belong to one tenant, behind that tenant's own
+ * mutexes. A burst of commands for one tenant therefore never waits
+ * on, or delays the expiry of, another tenant's alarms. Commands
+ * without a prefix belong to the tenant "default".
+ *
+ * Each tenant may hold at most quota_pending alarms (0 for no limit)
+ * and run at most quota_displays display threads.
+ */
+/*
+ * Work handed from a tenant's alarm thread to its executor thread:
+ * an alarm that has come due for a display, or one that has expired
+ * (at when). Each holds a reference to its alarm.
+ */
+#define EXPIRY_ASSIGN   1
+#define EXPIRY_EXPIRE   2
+
+typedef struct expiry_tag {
+    alarm_t             *alarm;
+    int                 kind;
+    time_t              when;
+} expiry_t;
+
+typedef struct tenant_tag {
+    char                name[16];
+    pthread_t           thread;         //The tenant's alarm thread
+    int                 running;        //Alarm thread started
+
+    pthread_mutex_t     alarm_mutex;    //Mutex for alarm
+    pthread_mutex_t     display_mutex;  //Mutex for display
+    pthread_cond_t      display_ready;  //A new display has been published
+    hot_t               *hot;           //The alarm list: hot records, sorted by ID
+    uint32_t            *hot_keys;      //Deadline of each record, or 0 for attention
+    size_t              hot_count;
+    size_t              hot_size;
+    time_t              hot_epoch;      //Time of hot deadline 0
+    _Atomic int         pending;        //Alarms started and not yet expired or cancelled
+
+    /*
+     * While the alarm thread is part way through a pass (scanning is
+     * set), it may let go of alarm_mutex between quanta of work, and
+     * the hot array has a gap in it. Alarms started then wait in
+     * incoming until the pass ends; code that reads the hot array
+     * waits on scan_cond.
+     */
+    int                 scanning;
+    pthread_cond_t      scan_cond;
+    alarm_t             **incoming;
+    size_t              incoming_count;
+    size_t              incoming_size;
+    alarm_t             **merging;      //Spare for incoming, while hot_merge works
+    size_t              merging_size;
+
+    /*
+     * Executor queue. The alarm thread only finds the alarms that are
+     * due; assigning them to displays (which may create a display
+     * thread) and printing their expiry is queued here for the
+     * executor thread. executing is set while the executor has work,
+     * queued or in hand. executor_mutex may be taken with alarm_mutex
+     * held, never the other way around.
+     */
+    pthread_t           executor;
+    pthread_mutex_t     executor_mutex;
+    pthread_cond_t      executor_cond;
+    expiry_t            *expiries;
+    size_t              expiry_count;
+    size_t              expiry_size;
+    int                 executing;
+
+    display_t           *display_threads[MAX_DISPLAYS];     //Limit display threads to 10 to prevent overload
+    int                 display_thread_count;   //Number of thread currently in the display array
+    unsigned            display_used;           //Bit i: display_threads[i] in use
+    display_type_t      display_types[MAX_DISPLAYS];
+
+    /*
+     * ID index, used to find an alarm by ID without searching
+     * the hot array under alarm_mutex, together with the handle slots
+     * and (with -D) the ID pages. index_mutex is a leaf lock: it may
+     * be taken with alarm_mutex held, never the other way around.
+     * It also protects cancelled, the alarms cancelled since the
+     * alarm thread's last pass, linked through index_link.
+     */
+    pthread_mutex_t     index_mutex;
+    alarm_t             **index_buckets;
+    size_t              index_size;     //Buckets, a power of two
+    size_t              index_count;
+    handle_slot_t       *handle_slots;
+    uint32_t            handle_count;   //Slots in use or on the free list
+    uint32_t            handle_size;
+    uint32_t            handle_free;    //Free list of slots
+    alarm_t             ***dense_pages;
+    size_t              dense_page_count;
+    alarm_t             *cancelled;
+
+    /*
+     * Tenant statistics, reported by the Stats command. Protected by
+     * alarm_mutex.
+     */
+    long                stats_started;
+    long                stats_changed;
+    long                stats_cancelled;
+    long                stats_expired;
+    long                stats_rejected; //Start_Alarm refused by the pending quota
+    _Atomic long        stats_dropped;  //Periodic prints dropped by the overload policy
+    _Atomic long        stats_coalesced;//Periodic prints replaced by a later one
+
+    /*
+     * Cold tier (see cold_ops_t). Alarms due at or after cold_until
+     * are held by the cold tier instead of the hot array. Protected by
+     * alarm_mutex.
+     */
+    time_t              cold_until;
+    long                cold_count;     //Alarms in the cold tier
+    void                *cold;          //Private to the cold tier
+} tenant_t;
+
+#define MAX_TENANTS     16
+
+pthread_mutex_t tenant_mutex = PTHREAD_MUTEX_INITIALIZER;   //Serializes creating tenants
+tenant_t *tenants[MAX_TENANTS];
+_Atomic int tenant_count = 0;                               //Published after tenants[] is filled in
+int tenants_started = 0;                                    //Start alarm threads as tenants appear
+int quota_pending = 0;                                      //-Q: alarms per tenant, 0 for no limit
+int quota_displays = 10;                                    //-Q: display threads per tenant
+
+int quiet = 0;                                              //-q: no prompt, delimited output
+
+
+/*
+ * Clock abstraction. Every timing decision in the program (reading
+ * the current time and sleeping between passes) goes through the
+ * clock_* functions below instead of calling time() and sleep()
+ * directly, so that a virtual clock can be substituted with -v.
+ *
+ * The virtual clock never sleeps for real. Each thread that takes
+ * part in the simulation is counted in vclock_threads; when every
+ * one of them is blocked in clock_sleep(), virtual time jumps
+ * straight to the earliest pending wakeup. A thread that is busy
+ * (or blocked reading input) holds the clock still, so a command
+ * file replayed through stdin produces the same timeline on every
+ * run, however long the alarms are.
+ */
+typedef struct clock_ops_tag {
+    void        (*init) (void);
+    time_t      (*now) (void);
+    void        (*sleep) (int seconds);
+    void        (*thread_start) (void);
+    void        (*thread_exit) (void);
+} clock_ops_t;
+
+typedef struct vclock_waiter_tag {
+    struct vclock_waiter_tag    *link;
+    time_t                      deadline;
+    int                         woken;
+} vclock_waiter_t;
+
+pthread_mutex_t vclock_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t vclock_cond = PTHREAD_COND_INITIALIZER;
+time_t vclock_time = 0;                                     //Current virtual time
+int vclock_threads = 0;                                     //Threads driving virtual time
+int vclock_sleepers = 0;                                    //Threads blocked in clock_sleep()
+vclock_waiter_t *vclock_waiters = NULL;
+
+/*
+ * Clock cache. Rather than have every thread ask the kernel for the
+ * time (and format it) over and over within the same second, the
+ * current tick is published once per tick in its own cache line,
+ * with its decimal rendering, and clock_now() only reads it. The
+ * real clock's tick thread publishes each second as it starts; the
+ * virtual clock publishes each time it advances.
+ *
+ * Readers use a sequence lock: the writer makes seq odd while it
+ * updates, and a reader that sees seq odd, or changed across its
+ * reads, reads again. Every field is atomic, so a torn read is
+ * discarded rather than undefined.
+ */
+typedef struct clock_cache_tag {
+    _Atomic unsigned    seq;
+    _Atomic long        now;
+    _Atomic int         length;                             //Digits in text
+    _Atomic uint64_t    text[3];                            //Decimal rendering of now
+} __attribute__ ((aligned (64))) clock_cache_t;
+
+clock_cache_t clock_cache;
+
+static void clock_cache_publish (time_t now) {
+    union { char c[24]; uint64_t w[3]; } text;
+    int length = snprintf (text.c, sizeof (text.c), "%ld", (long)now);
+    unsigned seq;
+
+    /*
+     * More than one thread may publish: the one that makes seq odd
+     * writes. A time already published, or older than the one that
+     * is (sampled before another writer's), is dropped, so the
+     * cache only ever moves forward.
+     */
+    do {
+        long cached;
+
+        seq = atomic_load_explicit (&clock_cache.seq, memory_order_relaxed);
+        cached = atomic_load_explicit (&clock_cache.now, memory_order_relaxed);
+        if (cached > (long)now || (cached == (long)now
+                && atomic_load_explicit (&clock_cache.length, memory_order_relaxed) > 0))
+            return;
+    } while ((seq & 1) != 0 || !atomic_compare_exchange_weak_explicit (&clock_cache.seq, &seq, seq + 1,
+            memory_order_relaxed, memory_order_relaxed));
+    atomic_thread_fence (memory_order_release);
+    atomic_store_explicit (&clock_cache.now, (long)now, memory_order_relaxed);
+    atomic_store_explicit (&clock_cache.length, length, memory_order_relaxed);
+    for (int i = 0; i < 3; i++)
+        atomic_store_explicit (&clock_cache.text[i], text.w[i], memory_order_relaxed);
+    atomic_store_explicit (&clock_cache.seq, seq + 2, memory_order_release);
+}
+
+static time_t clock_cache_now (void) {
+    return (time_t)atomic_load_explicit (&clock_cache.now, memory_order_acquire);
+}
+
+/*
+ * Copy the current time, in decimal, to buffer (at least 24 bytes,
+ * not terminated), and return its length.
+ */
+static int clock_cache_text (char *buffer) {
+    union { char c[24]; uint64_t w[3]; } text;
+    unsigned seq;
+    int length;
+
+    do {
+        seq = atomic_load_explicit (&clock_cache.seq, memory_order_acquire);
+        length = atomic_load_explicit (&clock_cache.length, memory_order_relaxed);
+        for (int i = 0; i < 3; i++)
+            text.w[i] = atomic_load_explicit (&clock_cache.text[i], memory_order_relaxed);
+        atomic_thread_fence (memory_order_acquire);
+    } while ((seq & 1) != 0 || seq != atomic_load_explicit (&clock_cache.seq, memory_order_relaxed));
+    memcpy (buffer, text.c, length);
+    return length;
+}
+
+/*
+ * The tick thread's start routine: publish each second of wall time
+ * as it begins.
+ */
+void *clock_tick_thread (void *arg) {
+    struct timespec now, pause;
+
+    while (1) {
+        clock_gettime (CLOCK_REALTIME, &now);
+        clock_cache_publish (now.tv_sec);
+        //Until the next second; exactly on one, a whole second (tv_nsec must stay below 10^9)
+        pause.tv_sec = now.tv_nsec == 0 ? 1 : 0;
+        pause.tv_nsec = now.tv_nsec == 0 ? 0 : 1000000000L - now.tv_nsec;
+        nanosleep (&pause, NULL);
+    }
+    return NULL;
+}
+
+static void real_clock_init (void) {
+    pthread_t thread;
+    int status;
+
+    clock_cache_publish (time (NULL));
+    status = pthread_create (&thread, NULL, clock_tick_thread, NULL);
+    if (status != 0)
+        err_abort (status, "Create clock tick thread");
+    status = pthread_detach (thread);
+    if (status != 0)
+        err_abort (status, "Detach clock tick thread");
+}
+
+/*
+ * A thread waking from a sleep may have slept through a stop of the
+ * whole process, and must not act on the time from before it, so it
+ * brings the cache up to date itself rather than wait for the tick
+ * thread to get around to it.
+ */
+static void real_clock_sleep (int seconds) {
+    sleep (seconds);
+    clock_cache_publish (time (NULL));
+}
+
+static void real_clock_thread (void) {
+}
+
+/*
+ * Advance virtual time to the earliest deadline once every thread
+ * is asleep. Waiters that become due are unlinked and counted as
+ * awake here, so that a second sleeper arriving before they run
+ * cannot push the clock past them. Called with vclock_mutex held.
+ */
+static void vclock_advance (void) {
+    vclock_waiter_t **last, *waiter;
+    time_t next;
+
+    if (vclock_sleepers < vclock_threads || vclock_waiters == NULL)
+        return;
+
+    next = vclock_waiters->deadline;
+    for (waiter = vclock_waiters->link; waiter != NULL; waiter = waiter->link)
+        if (waiter->deadline < next)
+            next = waiter->deadline;
+    if (next > vclock_time) {
+        vclock_time = next;
+        clock_cache_publish (vclock_time);
+    }
+
+    last = &vclock_waiters;
+    while ((waiter = *last) != NULL) {
+        if (waiter->deadline <= vclock_time) {
+            *last = waiter->link;
+            waiter->woken = 1;
+            vclock_sleepers--;
+        } else
+            last = &waiter->link;
+    }
+    pthread_cond_broadcast (&vclock_cond);
+}
+
+static void virtual_clock_init (void) {
+    clock_cache_publish (vclock_time);
+}
+
+static void virtual_clock_sleep (int seconds) {
+    vclock_waiter_t waiter;
+    int status;
+
+    status = pthread_mutex_lock (&vclock_mutex);
+    if (status != 0)
+        err_abort (status, "Lock clock mutex");
+    waiter.deadline = vclock_time + (seconds > 0 ? seconds : 0);
+    waiter.woken = 0;
+    waiter.link = vclock_waiters;
+    vclock_waiters = &waiter;
+    vclock_sleepers++;
+    vclock_advance ();
+    while (!waiter.woken) {
+        status = pthread_cond_wait (&vclock_cond, &vclock_mutex);
+        if (status != 0)
+            err_abort (status, "Wait on clock");
+    }
+    status = pthread_mutex_unlock (&vclock_mutex);
+    if (status != 0)
+        err_abort (status, "Unlock clock mutex");
+}
+
+/*
+ * Called by the creating thread before pthread_create(), so that the
+ * clock cannot run ahead while the new thread is still starting up.
+ */
+static void virtual_clock_thread_start (void) {
+    int status;
+
+    status = pthread_mutex_lock (&vclock_mutex);
+    if (status != 0)
+        err_abort (status, "Lock clock mutex");
+    vclock_threads++;
+    status = pthread_mutex_unlock (&vclock_mutex);
+    if (status != 0)
+        err_abort (status, "Unlock clock mutex");
+}
+
+static void virtual_clock_thread_exit (void) {
+    int status;
+
+    status = pthread_mutex_lock (&vclock_mutex);
+    if (status != 0)
+        err_abort (status, "Lock clock mutex");
+    vclock_threads--;
+    vclock_advance ();
+    status = pthread_mutex_unlock (&vclock_mutex);
+    if (status != 0)
+        err_abort (status, "Unlock clock mutex");
+}
+
+const clock_ops_t real_clock = {
+    real_clock_init, clock_cache_now, real_clock_sleep,
+    real_clock_thread, real_clock_thread
+};
+const clock_ops_t virtual_clock = {
+    virtual_clock_init, clock_cache_now, virtual_clock_sleep,
+    virtual_clock_thread_start, virtual_clock_thread_exit
+};
+const clock_ops_t *clock_ops = &real_clock;                 //Selected in main()
+
+#define clock_init()            (clock_ops->init ())
+#define clock_now()             (clock_ops->now ())
+#define clock_sleep(seconds)    (clock_ops->sleep (seconds))
+#define clock_thread_start()    (clock_ops->thread_start ())
+#define clock_thread_exit()     (clock_ops->thread_exit ())
+
+
+/*
+ * Output and engine locks. No thread prints while it holds one of
+ * the engine's locks, so that how long a lock is held never depends
+ * on how fast stdout (or stderr) is read. Code that runs under a lock
+ * formats its lines into a local output batch, and emits the batch
+ * in one write per stream once it has unlocked; anything else prints
+ * through output(), output_typed() and output_error().
+ *
+ * The engine locks (everything but the clock's) are taken through
+ * engine_lock() and engine_unlock(). Built with -DDEBUG, these count
+ * the locks each thread holds, and every way of printing asserts
+ * that the count is zero.
+ */
+#ifdef DEBUG
+_Thread_local int engine_locks_held = 0;
+# define assert_unlocked()      assert (engine_locks_held == 0)
+#else
+# define assert_unlocked()
+#endif
+
+static inline int engine_lock (pthread_mutex_t *mutex) {
+    int status = pthread_mutex_lock (mutex);
+#ifdef DEBUG
+    if (status == 0)
+        engine_locks_held++;
+#endif
+    return status;
+}
+
+static inline int engine_unlock (pthread_mutex_t *mutex) {
+#ifdef DEBUG
+    engine_locks_held--;
+#endif
+    return pthread_mutex_unlock (mutex);
+}
+
+typedef struct out_text_tag {
+    char        *text;
+    size_t      length;
+    size_t      size;
+    char        local[1024];                    //Enough for most batches, without malloc
+} out_text_t;
+
+typedef struct out_batch_tag {
+    out_text_t  out;                            //For stdout
+    out_text_t  err;                            //For stderr
+    out_text_t  typed;                          //For output channels, see channel_t
+} out_batch_t;
+
+static void out_text_init (out_text_t *text) {
+    text->text = text->local;
+    text->length = 0;
+    text->size = sizeof (text->local);
+}
+
+static void batch_init (out_batch_t *batch) {
+    out_text_init (&batch->out);
+    out_text_init (&batch->err);
+    out_text_init (&batch->typed);
+}
+
+/*
+ * Make room for length more bytes (and a terminating null).
+ */
+static char *out_text_reserve (out_text_t *text, size_t length) {
+    if (text->length + length + 1 > text->size) {
+        size_t size = text->size * 2;
+
+        while (text->length + length + 1 > size)
+            size *= 2;
+        if (text->text == text->local) {
+            text->text = malloc (size);
+            if (text->text == NULL)
+                errno_abort ("Allocate output batch");
+            memcpy (text->text, text->local, text->length);
+        } else {
+            text->text = realloc (text->text, size);
+            if (text->text == NULL)
+                errno_abort ("Allocate output batch");
+        }
+        text->size = size;
+    }
+    return text->text + text->length;
+}
+
+static void out_text_vprintf (out_text_t *text, const char *format, va_list args) {
+    va_list again;
+    int length;
+
+    va_copy (again, args);
+    length = vsnprintf (text->text + text->length, text->size - text->length, format, args);
+    if (length >= 0 && text->length + length + 1 > text->size) {
+        out_text_reserve (text, length);
+        vsnprintf (text->text + text->length, text->size - text->length, format, again);
+    }
+    va_end (again);
+    if (length > 0)
+        text->length += length;
+}
+
+static void batch_printf (out_batch_t *batch, const char *format, ...) {
+    va_list args;
+
+    va_start (args, format);
+    out_text_vprintf (&batch->out, format, args);
+    va_end (args);
+}
+
+static void batch_error (out_batch_t *batch, const char *format, ...) {
+    va_list args;
+
+    va_start (args, format);
+    out_text_vprintf (&batch->err, format, args);
+    va_end (args);
+}
+
+/*
+ * Output channels (-O dir[:limit]). Normally every line is printed on
+ * stdout. With -O, the lines about each alarm type go instead to a
+ * channel of their own, the file dir/<type> (or a FIFO of that name
+ * made by whoever reads it), each with its own writer thread; only
+ * View_Alarms, Stats, the prompt and errors stay on stdout. A reader
+ * that is slow to take one type's lines then holds up nothing but
+ * that type's writer.
+ *
+ * Lines are appended to the channel's backlog, and the writer takes
+ * the whole backlog at a time and writes it with one write(). The
+ * backlog is held to limit bytes: lines that would take it past
+ * that are dropped, and the writer says how many once it catches up.
+ *
+ * A channel whose backlog is over half its limit is behind, and a
+ * display's periodic lines for it are handled by the overload policy
+ * (-W): coalesce keeps only the latest unwritten line for each alarm,
+ * written in the place in the backlog where it was last queued (so
+ * that it never follows, say, the alarm's later "Stopped Printing"
+ * line), but without counting towards the limit; drop throws the
+ * line away; block
+ * makes the display wait until the channel has caught up. Dropped and
+ * coalesced lines are counted in each tenant's Stats.
+ *
+ * A channel whose file cannot be opened or written (say its reader
+ * has gone away) is closed, with one error, and its lines are thrown
+ * away from then on; the engine and the other channels carry on.
+ */
+#define MAX_CHANNELS    32
+
+#define OVERLOAD_COALESCE       0
+#define OVERLOAD_DROP           1
+#define OVERLOAD_BLOCK          2
+
+typedef struct channel_tick_tag {
+    const void          *tenant;                //With alarm_ID, the alarm the line is for
+    int                 alarm_ID;
+    size_t              at;                     //Backlog length when it was queued: its place
+    size_t              length;
+    char                text[320];
+} channel_tick_t;
+
+typedef struct channel_tag {
+    char                type[3];
+    int                 fd;
+    pthread_mutex_t     mutex;
+    pthread_cond_t      cond;                   //Backlog added to, or written
+    char                *backlog;
+    size_t              length;
+    size_t              size;
+    long                dropped;                //Lines dropped since the last report
+    int                 writing;                //Writer is writing a backlog it took
+    int                 closed;                 //Open or write failed: lines are thrown away
+    channel_tick_t      *ticks;                 //Coalesced periodic lines, one per alarm
+    int                 tick_count;
+    int                 tick_size;
+    pthread_t           writer;
+} channel_t;
+
+typedef struct channel_header_tag {
+    char                type[3];
+    char                periodic;               //A display's periodic line, for this alarm:
+    int                 alarm_ID;
+    tenant_t            *tenant;
+    uint32_t            length;
+} channel_header_t;                             //Before each line in out_batch_t.typed
+
+char *channel_dir = NULL;                                   //-O: directory, NULL for stdout
+size_t channel_limit = 1 << 20;                             //-O: bytes of backlog per channel
+int overload_policy = OVERLOAD_COALESCE;                    //-W: periodic lines when behind
+pthread_mutex_t channel_mutex = PTHREAD_MUTEX_INITIALIZER;  //Serializes creating channels
+channel_t *channels[MAX_CHANNELS];
+_Atomic int channel_count = 0;                              //Published after channels[] is filled in
+
+/*
+ * Add length bytes to a channel's backlog, growing it as needed.
+ * Called with the channel's mutex held.
+ */
+static void channel_append (channel_t *channel, const char *text, size_t length) {
+    if (channel->length + length > channel->size) {
+        size_t size = channel->size > 0 ? channel->size : 4096;
+
+        while (channel->length + length > size)
+            size *= 2;
+        channel->backlog = realloc (channel->backlog, size);
+        if (channel->backlog == NULL)
+            errno_abort ("Allocate channel backlog");
+        channel->size = size;
+    }
+    memcpy (channel->backlog + channel->length, text, length);
+    channel->length += length;
+}
+
+/*
+ * Close a channel that could not be opened or written, so that its
+ * lines are thrown away rather than queued. Called by its writer,
+ * without the channel's mutex.
+ */
+static void channel_fail (channel_t *channel, const char *path, const char *what) {
+    int status;
+
+    fprintf (stderr, "ERROR: %s output channel %s: %s; its lines are dropped from now on\n", what, path, strerror (errno));
+    if (channel->fd >= 0)
+        close (channel->fd);
+    status = pthread_mutex_lock (&channel->mutex);
+    if (status != 0)
+        err_abort (status, "Lock channel mutex");
+    channel->fd = -1;
+    channel->closed = 1;
+    channel->length = 0;
+    channel->tick_count = 0;
+    status = pthread_cond_broadcast (&channel->cond);       //Wake blocked displays
+    if (status != 0)
+        err_abort (status, "Signal channel");
+    status = pthread_mutex_unlock (&channel->mutex);
+    if (status != 0)
+        err_abort (status, "Unlock channel mutex");
+}
+
+static int channel_tick_compare (const void *a, const void *b) {
+    size_t first = ((const channel_tick_t *)a)->at, second = ((const channel_tick_t *)b)->at;
+
+    return first < second ? -1 : first > second;
+}
+
+/*
+ * Put the coalesced periodic lines into the backlog, each where it
+ * was queued. Called by the writer with the channel's mutex held.
+ */
+static void channel_place_ticks (channel_t *channel) {
+    size_t length = channel->length, from = 0, to = 0;
+    char *merged;
+
+    qsort (channel->ticks, channel->tick_count, sizeof (channel_tick_t), channel_tick_compare);
+    for (int i = 0; i < channel->tick_count; i++)
+        length += channel->ticks[i].length;
+    merged = malloc (length > channel->size ? length : channel->size);
+    if (merged == NULL)
+        errno_abort ("Allocate channel backlog");
+    for (int i = 0; i < channel->tick_count; i++) {
+        size_t at = channel->ticks[i].at;
+
+        if (at > from) {
+            memcpy (merged + to, channel->backlog + from, at - from);
+            to += at - from;
+            from = at;
+        }
+        memcpy (merged + to, channel->ticks[i].text, channel->ticks[i].length);
+        to += channel->ticks[i].length;
+    }
+    if (channel->length > from)
+        memcpy (merged + to, channel->backlog + from, channel->length - from);
+    free (channel->backlog);
+    channel->backlog = merged;
+    channel->size = length > channel->size ? length : channel->size;
+    channel->length = length;
+    channel->tick_count = 0;
+}
+
+/*
+ * The writer thread's start routine: one per channel.
+ */
+void *channel_writer (void *arg) {
+    channel_t *channel = (channel_t *)arg;
+    char path[1024], report[96], *text = NULL;
+    size_t text_size = 0, length;
+    long dropped;
+    int status;
+
+    snprintf (path, sizeof (path), "%s/%s", channel_dir, channel->type);
+    channel->fd = open (path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (channel->fd < 0)
+        channel_fail (channel, path, "Open");
+
+    while (1) {
+        status = pthread_mutex_lock (&channel->mutex);
+        if (status != 0)
+            err_abort (status, "Lock channel mutex");
+        channel->writing = 0;
+        while (channel->length == 0 && channel->dropped == 0 && channel->tick_count == 0) {
+            status = pthread_cond_broadcast (&channel->cond);   //Wake channel_drain()
+            if (status != 0)
+                err_abort (status, "Signal channel");
+            status = pthread_cond_wait (&channel->cond, &channel->mutex);
+            if (status != 0)
+                err_abort (status, "Wait on channel");
+        }
+
+        //The latest periodic line for each alarm goes back in its place
+        if (channel->tick_count > 0)
+            channel_place_ticks (channel);
+
+        //Take the whole backlog, leaving the spare buffer in its place
+        char *taken = channel->backlog;
+        size_t size = channel->size;
+        length = channel->length;
+        dropped = channel->dropped;
+        channel->backlog = text;
+        channel->size = text_size;
+        channel->length = 0;
+        channel->dropped = 0;
+        channel->writing = 1;
+        text = taken;
+        text_size = size;
+        status = pthread_cond_broadcast (&channel->cond);       //Wake blocked displays
+        if (status != 0)
+            err_abort (status, "Signal channel");
+        status = pthread_mutex_unlock (&channel->mutex);
+        if (status != 0)
+            err_abort (status, "Unlock channel mutex");
+
+        if (dropped > 0) {
+            length += snprintf (report, sizeof (report), "Output Dropped %ld Lines at %ld\n", dropped, (long)clock_cache_now ());
+            if (length > text_size) {
+                text = realloc (text, length);
+                if (text == NULL)
+                    errno_abort ("Allocate channel backlog");
+                text_size = length;
+            }
+            memcpy (text + length - strlen (report), report, strlen (report));
+        }
+        for (size_t done = 0; done < length && !channel->closed; ) {
+            ssize_t n = write (channel->fd, text + done, length - done);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0) {
+                channel_fail (channel, path, "Write");
+                break;
+            }
+            done += n;
+        }
+    }
+}
+
+/*
+ * Find the channel for an alarm type, creating it (and starting its
+ * writer) the first time. Returns NULL once there are MAX_CHANNELS,
+ * and the type's lines go to stdout.
+ */
+static channel_t *channel_find (const char *type) {
+    channel_t *channel = NULL;
+    int status;
+
+    for (int i = 0; i < atomic_load (&channel_count); i++)
+        if (strcmp (channels[i]->type, type) == 0)
+            return channels[i];
+
+    status = pthread_mutex_lock (&channel_mutex);
+    if (status != 0)
+        err_abort (status, "Lock channel mutex");
+    for (int i = 0; i < atomic_load (&channel_count) && channel == NULL; i++)
+        if (strcmp (channels[i]->type, type) == 0)
+            channel = channels[i];
+    if (channel == NULL && atomic_load (&channel_count) < MAX_CHANNELS) {
+        channel = calloc (1, sizeof (channel_t));
+        if (channel == NULL)
+            errno_abort ("Allocate channel");
+        snprintf (channel->type, sizeof (channel->type), "%s", type);
+        channel->fd = -1;
+        status = pthread_mutex_init (&channel->mutex, NULL);
+        if (status != 0)
+            err_abort (status, "Init channel mutex");
+        status = pthread_cond_init (&channel->cond, NULL);
+        if (status != 0)
+            err_abort (status, "Init channel cond");
+        status = pthread_create (&channel->writer, NULL, channel_writer, channel);
+        if (status != 0)
+            err_abort (status, "Create channel writer");
+        channels[atomic_load (&channel_count)] = channel;
+        atomic_fetch_add (&channel_count, 1);
+    }
+    status = pthread_mutex_unlock (&channel_mutex);
+    if (status != 0)
+        err_abort (status, "Unlock channel mutex");
+    return channel;
+}
+
+/*
+ * Add a line to a channel's backlog, or drop it if the backlog is
+ * full.
+ */
+static void channel_put (channel_t *channel, const char *text, size_t length) {
+    int status;
+
+    status = pthread_mutex_lock (&channel->mutex);
+    if (status != 0)
+        err_abort (status, "Lock channel mutex");
+    //A closed channel throws its lines away
+    if (!channel->closed) {
+        if (channel->length + length > channel_limit)
+            channel->dropped++;
+        else
+            channel_append (channel, text, length);
+    }
+    status = pthread_cond_broadcast (&channel->cond);
+    if (status != 0)
+        err_abort (status, "Signal channel");
+    status = pthread_mutex_unlock (&channel->mutex);
+    if (status != 0)
+        err_abort (status, "Unlock channel mutex");
+}
+
+/*
+ * Add a display's periodic line to a channel, applying the overload
+ * policy if the channel is behind.
+ */
+static void channel_put_periodic (channel_t *channel, const channel_header_t *header, const char *text) {
+    size_t high = channel_limit / 2;
+    int i, status;
+
+    status = pthread_mutex_lock (&channel->mutex);
+    if (status != 0)
+        err_abort (status, "Lock channel mutex");
+    while (overload_policy == OVERLOAD_BLOCK && channel->length + header->length > high
+            && channel->length > 0 && !channel->closed) {
+        status = pthread_cond_wait (&channel->cond, &channel->mutex);
+        if (status != 0)
+            err_abort (status, "Wait on channel");
+    }
+    if (channel->closed) {
+        atomic_fetch_add (&header->tenant->stats_dropped, 1);
+    } else if (channel->length + header->length <= high) {
+        channel_append (channel, text, header->length);
+    } else if (overload_policy == OVERLOAD_DROP || header->length > sizeof (channel->ticks->text)) {
+        atomic_fetch_add (&header->tenant->stats_dropped, 1);
+    } else {
+        for (i = 0; i < channel->tick_count; i++)
+            if (channel->ticks[i].tenant == header->tenant && channel->ticks[i].alarm_ID == header->alarm_ID)
+                break;
+        if (i < channel->tick_count) {
+            atomic_fetch_add (&header->tenant->stats_coalesced, 1);
+        } else {
+            if (channel->tick_count == channel->tick_size) {
+                channel->tick_size = channel->tick_size > 0 ? channel->tick_size * 2 : 16;
+                channel->ticks = realloc (channel->ticks, channel->tick_size * sizeof (channel_tick_t));
+                if (channel->ticks == NULL)
+                    errno_abort ("Allocate channel ticks");
+            }
+            channel->tick_count++;
+        }
+        channel->ticks[i].tenant = header->tenant;
+        channel->ticks[i].alarm_ID = header->alarm_ID;
+        channel->ticks[i].at = channel->length;
+        channel->ticks[i].length = header->length;
+        memcpy (channel->ticks[i].text, text, header->length);
+    }
+    status = pthread_cond_broadcast (&channel->cond);
+    if (status != 0)
+        err_abort (status, "Signal channel");
+    status = pthread_mutex_unlock (&channel->mutex);
+    if (status != 0)
+        err_abort (status, "Unlock channel mutex");
+}
+
+/*
+ * Wait until every channel's writer has written all it was given.
+ */
+void channel_drain (void) {
+    int status;
+
+    for (int i = 0; i < atomic_load (&channel_count); i++) {
+        channel_t *channel = channels[i];
+
+        status = pthread_mutex_lock (&channel->mutex);
+        if (status != 0)
+            err_abort (status, "Lock channel mutex");
+        while (channel->length > 0 || channel->dropped > 0 || channel->tick_count > 0 || channel->writing) {
+            status = pthread_cond_wait (&channel->cond, &channel->mutex);
+            if (status != 0)
+                err_abort (status, "Wait on channel");
+        }
+        status = pthread_mutex_unlock (&channel->mutex);
+        if (status != 0)
+            err_abort (status, "Unlock channel mutex");
+    }
+}
+
+/*
+ * Send a line about an alarm type to its channel, or to stdout.
+ */
+static void channel_line (const channel_header_t *header, const char *text) {
+    channel_t *channel = channel_find (header->type);
+
+    if (channel == NULL)
+        fwrite (text, 1, header->length, stdout);
+    else if (header->periodic)
+        channel_put_periodic (channel, header, text);
+    else
+        channel_put (channel, text, header->length);
+}
+
+/*
+ * Start a line about an alarm type: on stdout, or with -O, in the
+ * typed part of the batch behind a header that batch_typed_end()
+ * fills in.
+ */
+static out_text_t *batch_typed_begin (out_batch_t *batch, size_t *start) {
+    if (channel_dir == NULL)
+        return &batch->out;
+    *start = batch->typed.length;
+    out_text_reserve (&batch->typed, sizeof (channel_header_t));
+    batch->typed.length += sizeof (channel_header_t);
+    return &batch->typed;
+}
+
+static channel_header_t *batch_typed_end (out_batch_t *batch, const char *type, size_t start) {
+    channel_header_t header;
+
+    if (channel_dir == NULL)
+        return NULL;
+    memset (&header, 0, sizeof (header));
+    strncpy (header.type, type, sizeof (header.type) - 1);
+    header.length = batch->typed.length - start - sizeof (header);
+    memcpy (batch->typed.text + start, &header, sizeof (header));
+    return (channel_header_t *)(batch->typed.text + start);
+}
+
+static void batch_typed (out_batch_t *batch, const char *type, const char *format, ...) {
+    out_text_t *text;
+    size_t start = 0;
+    va_list args;
+
+    text = batch_typed_begin (batch, &start);
+    va_start (args, format);
+    out_text_vprintf (text, format, args);
+    va_end (args);
+    batch_typed_end (batch, type, start);
+}
+
+/*
+ * Append a display's periodic line, already formatted, for an alarm.
+ */
+static void batch_periodic (out_batch_t *batch, const char *type, tenant_t *tenant, int alarm_ID, const char *line, size_t length) {
+    channel_header_t header, *typed;
+    out_text_t *text;
+    size_t start = 0;
+
+    text = batch_typed_begin (batch, &start);
+    memcpy (out_text_reserve (text, length), line, length);
+    text->length += length;
+    typed = batch_typed_end (batch, type, start);
+    if (typed != NULL) {
+        memcpy (&header, typed, sizeof (header));
+        header.periodic = 1;
+        header.tenant = tenant;
+        header.alarm_ID = alarm_ID;
+        memcpy (typed, &header, sizeof (header));
+    }
+}
+
+static void out_text_emit (out_text_t *text, FILE *stream) {
+    if (text->length > 0)
+        fwrite (text->text, 1, text->length, stream);
+    if (text->text != text->local)
+        free (text->text);
+    out_text_init (text);
+}
+
+/*
+ * Print a batch, and empty it for reuse. Called with no engine lock
+ * held.
+ */
+static void batch_emit (out_batch_t *batch) {
+    channel_header_t header;
+
+    assert_unlocked ();
+    out_text_emit (&batch->err, stderr);
+    out_text_emit (&batch->out, stdout);
+    for (size_t at = 0; at < batch->typed.length; at += sizeof (header) + header.length) {
+        memcpy (&header, batch->typed.text + at, sizeof (header));
+        channel_line (&header, batch->typed.text + at + sizeof (header));
+    }
+    if (batch->typed.text != batch->typed.local)
+        free (batch->typed.text);
+    out_text_init (&batch->typed);
+}
+
+static void output (const char *format, ...) {
+    va_list args;
+
+    assert_unlocked ();
+    va_start (args, format);
+    vprintf (format, args);
+    va_end (args);
+}
+
+/*
+ * Print a line about an alarm type, on stdout or its channel.
+ */
+static void output_typed (const char *type, const char *format, ...) {
+    char line[512];
+    va_list args;
+    int length;
+
+    assert_unlocked ();
+    va_start (args, format);
+    if (channel_dir == NULL) {
+        vprintf (format, args);
+    } else {
+        length = vsnprintf (line, sizeof (line), format, args);
+        channel_header_t header;
+
+        memset (&header, 0, sizeof (header));
+        strncpy (header.type, type, sizeof (header.type) - 1);
+        header.length = length < (int)sizeof (line) ? (size_t)length : sizeof (line) - 1;
+        channel_line (&header, line);
+    }
+    va_end (args);
+}
+
+static void output_error (const char *format, ...) {
+    va_list args;
+
+    assert_unlocked ();
+    va_start (args, format);
+    vfprintf (stderr, format, args);
+    va_end (args);
+}
+
+
+/*
+ * Drop one reference to an alarm, freeing it with the last one.
+ */
+void alarm_release (alarm_t *alarm) {
+    if (atomic_fetch_sub(&alarm->refs, 1) == 1) {
+        atomic_store(&alarm->state, ALARM_FREED);
+        free(alarm);
+    }
+}
+
+/*
+ * Is the alarm still waiting for its time (not fired or cancelled)?
+ */
+static int alarm_live (alarm_t *alarm) {
+    int state = atomic_load(&alarm->state);
+    return state == ALARM_PENDING || state == ALARM_ASSIGNED;
+}
+
+static size_t index_hash (tenant_t *tenant, int alarm_ID) {
+    return ((unsigned)alarm_ID * 2654435761U) & (tenant->index_size - 1);
+}
+
+/*
+ * Add an alarm to the ID index, growing the table as it fills. The
+ * newest alarm with a given ID is found first.
+ */
+void index_insert (alarm_t *alarm) {
+    tenant_t *tenant = alarm->tenant;
+    int status;
+
+    status = engine_lock(&tenant->index_mutex);
+    if (status != 0) {err_abort(status, "Lock index mutex");}
+    if (dense_ids) {
+        size_t page = (size_t)alarm->alarm_ID / DENSE_PAGE;
+
+        if (page >= tenant->dense_page_count) {
+            size_t count = tenant->dense_page_count ? tenant->dense_page_count : 16;
+            while (count <= page)
+                count *= 2;
+            tenant->dense_pages = (alarm_t ***)realloc(tenant->dense_pages, count * sizeof(alarm_t **));
+            if (tenant->dense_pages == NULL) {errno_abort("Allocate index");}
+            memset(tenant->dense_pages + tenant->dense_page_count, 0, (count - tenant->dense_page_count) * sizeof(alarm_t **));
+            tenant->dense_page_count = count;
+        }
+        if (tenant->dense_pages[page] == NULL) {
+            tenant->dense_pages[page] = (alarm_t **)calloc(DENSE_PAGE, sizeof(alarm_t *));
+            if (tenant->dense_pages[page] == NULL) {errno_abort("Allocate index");}
+        }
+        tenant->dense_pages[page][alarm->alarm_ID % DENSE_PAGE] = alarm;
+    } else if (tenant->index_count >= tenant->index_size) {
+        alarm_t **old = tenant->index_buckets;
+        size_t old_size = tenant->index_size;
+
+        tenant->index_size = tenant->index_size ? tenant->index_size * 2 : 1024;
+        tenant->index_buckets = (alarm_t **)calloc(tenant->index_size, sizeof(alarm_t *));
+        if (tenant->index_buckets == NULL) {errno_abort("Allocate index");}
+        for (size_t i = old_size; i-- > 0; ) {
+            alarm_t *next;
+            for (alarm_t *entry = old[i]; entry != NULL; entry = next) {
+                next = entry->index_link;
+                size_t bucket = index_hash(tenant, entry->alarm_ID);
+                entry->index_link = tenant->index_buckets[bucket];
+                tenant->index_buckets[bucket] = entry;
+            }
+        }
+        free(old);
+    }
+    if (!dense_ids) {
+        size_t bucket = index_hash(tenant, alarm->alarm_ID);
+        alarm->index_link = tenant->index_buckets[bucket];
+        tenant->index_buckets[bucket] = alarm;
+    }
+    tenant->index_count++;
+
+    //Give the alarm a handle slot, reusing a freed one if there is one
+    uint32_t slot = tenant->handle_free;
+    if (slot != HANDLE_NONE) {
+        tenant->handle_free = tenant->handle_slots[slot].next_free;
+    } else {
+        if (tenant->handle_count == tenant->handle_size) {
+            tenant->handle_size = tenant->handle_size ? tenant->handle_size * 2 : 1024;
+            tenant->handle_slots = (handle_slot_t *)realloc(tenant->handle_slots, tenant->handle_size * sizeof(handle_slot_t));
+            if (tenant->handle_slots == NULL) {errno_abort("Allocate handles");}
+        }
+        slot = tenant->handle_count++;
+        tenant->handle_slots[slot].generation = 1;
+    }
+    tenant->handle_slots[slot].alarm = alarm;
+    alarm->handle = (uint64_t)tenant->handle_slots[slot].generation << 32 | slot;
+    status = engine_unlock(&tenant->index_mutex);
+    if (status != 0) {err_abort(status, "Unlock index mutex");}
+}
+
+/*
+ * Remove an alarm from the ID index. Called with index_mutex held.
+ */
+static void index_unlink (alarm_t *alarm) {
+    tenant_t *tenant = alarm->tenant;
+    alarm_t **last;
+
+    if (dense_ids) {
+        last = &tenant->dense_pages[alarm->alarm_ID / DENSE_PAGE][alarm->alarm_ID % DENSE_PAGE];
+    } else {
+        last = &tenant->index_buckets[index_hash(tenant, alarm->alarm_ID)];
+        while (*last != NULL && *last != alarm)
+            last = &(*last)->index_link;
+    }
+    if (*last == alarm) {
+        *last = alarm->index_link;
+        tenant->index_count--;
+
+        //Free the handle slot; the new generation makes old handles stale
+        handle_slot_t *slot = &tenant->handle_slots[(uint32_t)alarm->handle];
+        slot->alarm = NULL;
+        if (++slot->generation == 0)
+            slot->generation = 1;
+        slot->next_free = tenant->handle_free;
+        tenant->handle_free = (uint32_t)alarm->handle;
+    }
+}
+
+/*
+ * Find the newest live alarm with an ID, through the ID hash. Called
+ * with index_mutex held.
+ */
+static alarm_t *index_find (tenant_t *tenant, int alarm_ID) {
+    alarm_t *alarm = tenant->index_size ? tenant->index_buckets[index_hash(tenant, alarm_ID)] : NULL;
+
+    while (alarm != NULL && (alarm->alarm_ID != alarm_ID || !alarm_live(alarm)))
+        alarm = alarm->index_link;
+    return alarm;
+}
+
+/*
+ * Find an alarm by engine-assigned ID. Called with index_mutex held.
+ */
+static alarm_t *dense_lookup (tenant_t *tenant, int alarm_ID) {
+    size_t page = (size_t)alarm_ID / DENSE_PAGE;
+
+    if (alarm_ID < 0 || page >= tenant->dense_page_count || tenant->dense_pages[page] == NULL)
+        return NULL;
+    return tenant->dense_pages[page][alarm_ID % DENSE_PAGE];
+}
+
+/*
+ * Take the next engine-assigned ID from this thread's block.
+ */
+static int dense_allocate (void) {
+    if (dense_block_next == dense_block_end) {
+        dense_block_next = atomic_fetch_add(&dense_next, DENSE_BLOCK);
+        dense_block_end = dense_block_next + DENSE_BLOCK;
+    }
+    return dense_block_next++;
+}
+
+/*
+ * Find the alarm a handle refers to, or NULL if the handle is stale
+ * or was never issued. Called with index_mutex held.
+ */
+static alarm_t *handle_lookup (tenant_t *tenant, uint64_t handle) {
+    uint32_t slot = (uint32_t)handle;
+
+    if (slot >= tenant->handle_count || tenant->handle_slots[slot].generation != (uint32_t)(handle >> 32))
+        return NULL;
+    return tenant->handle_slots[slot].alarm;
+}
+
+void index_remove (alarm_t *alarm) {
+    tenant_t *tenant = alarm->tenant;
+    int status;
+
+    status = engine_lock(&tenant->index_mutex);
+    if (status != 0) {err_abort(status, "Lock index mutex");}
+    index_unlink(alarm);
+    status = engine_unlock(&tenant->index_mutex);
+    if (status != 0) {err_abort(status, "Unlock index mutex");}
+}
+
+/*
+ * Allocate an alarm of a tenant in the PENDING state, holding the
+ * references of its hot record and the ID index (the caller adds it
+ * to both).
+ */
+alarm_t *alarm_create (tenant_t *tenant) {
+    alarm_t *alarm = (alarm_t *)malloc(sizeof(alarm_t));
+    if (alarm == NULL) {errno_abort("Allocate alarm");}
+    alarm->tenant = tenant;
+    alarm->client = -1;
+    alarm->index_link = NULL;
+    alarm->handle = 0;
+    atomic_init(&alarm->state, ALARM_PENDING);
+    atomic_init(&alarm->refs, 2);
+    atomic_init(&alarm->revision, 0);
+    return alarm;
+}
+
+/*
+ * Find the first hot record with an ID not less than alarm_ID.
+ * Called with alarm_mutex held.
+ */
+static size_t hot_search (tenant_t *tenant, int alarm_ID) {
+    size_t low = 0, high = tenant->hot_count;
+
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+        if (tenant->hot[middle].alarm_ID < alarm_ID)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+/*
+ * Find an alarm's hot record. Called with alarm_mutex held.
+ */
+static hot_t *hot_find (alarm_t *alarm) {
+    tenant_t *tenant = alarm->tenant;
+
+    for (size_t i = hot_search(tenant, alarm->alarm_ID); i < tenant->hot_count && tenant->hot[i].alarm_ID == alarm->alarm_ID; i++)
+        if (tenant->hot[i].body == alarm)
+            return &tenant->hot[i];
+    return NULL;
+}
+
+/*
+ * Shared memory front end (-s name). Co-located processes submit
+ * binary commands through the rings described in alarm_shm.h; the
+ * shm thread applies them, and the engine reports back into the
+ * submitting client's completion ring when one of its alarms expires
+ * or is cancelled.
+ */
+const char *shm_name = NULL;
+alarm_shm_t *shm = NULL;
+volatile sig_atomic_t shm_stop = 0;                         //Set by SIGINT/SIGTERM
+
+/*
+ * Post a completion for an alarm that came from a shared memory
+ * client. The engine never waits for a slow client: if its ring is
+ * full the completion is dropped (and counted in the ring).
+ */
+void shm_notify (alarm_t *alarm, int op) {
+    alarm_shm_record_t record;
+
+    if (shm == NULL || alarm->client < 0)
+        return;
+    memset(&record, 0, sizeof(record));
+    record.op = op;
+    record.client = alarm->client;
+    record.alarm_ID = alarm->alarm_ID;
+    record.seconds = alarm->seconds;
+    record.time = clock_now();
+    memcpy(record.type, alarm->type, sizeof(record.type));
+    memcpy(record.message, alarm->message, sizeof(record.message));
+    alarm_shm_push(&shm->clients[alarm->client].ring, shm->clients[alarm->client].cells, &record);
+}
+
+
+/*
+ * Replication (-R address on the primary, -F address on a follower).
+ * Every change to the alarm list is appended, while alarm_mutex is still
+ * held, to an in-memory log that the replication thread ships to the
+ * connected follower in batches. Appending under alarm_mutex means
+ * the log order is exactly the order in which the list changed, and
+ * a snapshot taken under the same lock lines up with the log.
+ */
+typedef enum {
+    REPL_START = 1,
+    REPL_CHANGE,
+    REPL_CANCEL,
+    REPL_EXPIRE
+} repl_op_t;
+
+typedef struct repl_record_tag {
+    int                 op;
+    char                tenant[16];
+    int                 alarm_ID;
+    int                 seconds;
+    time_t              time;
+    char                type[3];
+    char                message[128];
+} repl_record_t;
+
+#define REPL_MAGIC          0x41525032U     //"ARP2", at the start of each batch
+#define REPL_RECORD_SIZE    176             //Bytes per record on the wire
+#define REPL_BATCH          256             //Records per batch, at most
+#define REPL_FLUSH_MS       10              //Longest a record waits for its batch
+#define REPL_BACKLOG        (1 << 20)       //Records queued before the follower is dropped
+
+pthread_mutex_t repl_mutex = PTHREAD_MUTEX_INITIALIZER;    //Protects the replication log
+pthread_cond_t repl_cond = PTHREAD_COND_INITIALIZER;
+const char *repl_address = NULL;                            //-R: listen for a follower here
+const char *follow_address = NULL;                          //-F: follow the primary there
+int repl_active = 0;                                        //A follower is connected
+repl_record_t *repl_log_records = NULL;
+int repl_log_count = 0;
+int repl_log_size = 0;
+
+/*
+ * Append one change to the replication log. Called with alarm_mutex
+ * held; does nothing unless a follower is connected.
+ */
+void repl_log (int op, alarm_t *alarm) {
+    repl_record_t *record;
+    int status;
+
+    if (repl_address == NULL)
+        return;
+    status = engine_lock(&repl_mutex);
+    if (status != 0) {err_abort(status, "Lock replication mutex");}
+    if (repl_active && repl_log_count < REPL_BACKLOG) {
+        if (repl_log_count == repl_log_size) {
+            repl_log_size = repl_log_size ? repl_log_size * 2 : REPL_BATCH;
+            repl_log_records = realloc(repl_log_records, repl_log_size * sizeof(repl_record_t));
+            if (repl_log_records == NULL) {errno_abort("Allocate replication log");}
+        }
+        record = &repl_log_records[repl_log_count++];
+        record->op = op;
+        memcpy(record->tenant, alarm->tenant->name, sizeof(record->tenant));
+        record->alarm_ID = alarm->alarm_ID;
+        record->seconds = alarm->seconds;
+        record->time = alarm->time;
+        memcpy(record->type, alarm->type, sizeof(record->type));
+        memcpy(record->message, alarm->message, sizeof(record->message));
+        //Wake the replication thread for the first record of a batch, and when it is full
+        if (repl_log_count == 1 || repl_log_count == REPL_BATCH) {
+            status = pthread_cond_signal(&repl_cond);
+            if (status != 0) {err_abort(status, "Signal replication");}
+        }
+    } else if (repl_active) {
+        //The follower cannot keep up; the replication thread will drop it
+        repl_active = 0;
+        status = pthread_cond_signal(&repl_cond);
+        if (status != 0) {err_abort(status, "Signal replication");}
+    }
+    status = engine_unlock(&repl_mutex);
+    if (status != 0) {err_abort(status, "Unlock replication mutex");}
+}
+
+/*
+ * Cold tier (-T horizon[:partition] -C store). Only alarms due
+ * within the horizon are kept in the alarm list as alarm_t; alarms
+ * further out are handed to a cold tier, which holds them in a
+ * cheaper form and gives them back a partition at a time. Time is
+ * cut into partitions of cold_partition seconds, and each tenant's
+ * cold_until is always a partition boundary: when the horizon
+ * reaches it, the alarm thread pages the next partition in and
+ * moves cold_until on, so alarms come back at least a partition's
+ * length before they are due.
+ *
+ * Cold alarms are not displayed until they are paged in, and get a
+ * handle only then. They can still be changed and cancelled by ID.
+ * All the cold tier operations are called with the tenant's
+ * alarm_mutex held. load restores about limit alarms at a time (0
+ * for no limit), leaving the tier consistent, and returns 1 if
+ * there are more below until.
+ */
+typedef struct cold_record_tag {
+    int                 op;             //COLD_START, or COLD_CHANGE of an earlier start
+    int                 alarm_ID;
+    int                 seconds;
+    int                 client;
+    time_t              time;
+    char                type[3];
+    char                message[128];
+} cold_record_t;
+
+#define COLD_START      1
+#define COLD_CHANGE     2
+
+typedef struct cold_ops_tag {
+    void        (*put) (tenant_t *tenant, const cold_record_t *record);
+    int         (*load) (tenant_t *tenant, time_t until, long limit, void (*restore) (tenant_t *, const cold_record_t *));
+    int         (*cancel) (tenant_t *tenant, int alarm_ID, cold_record_t *found);
+    int         (*change) (tenant_t *tenant, int alarm_ID, int seconds, const char *message, cold_record_t *found);
+    void        (*scan) (tenant_t *tenant, void (*emit) (tenant_t *, const cold_record_t *));
+} cold_ops_t;
+
+const cold_ops_t *cold_ops = NULL;                          //NULL: everything stays in memory
+time_t cold_horizon = 0;
+time_t cold_partition = 0;
+const char *cold_store = NULL;                              //-C: directory, or "mem"
+
+/*
+ * Disk cold tier. Each partition of each tenant is an append-only
+ * file of cold_record_t in cold_store, named "tenant.partition". A
+ * Change_Alarm to a cold alarm is appended to the alarm's partition
+ * and applied when the partition is read back.
+ *
+ * What stays in memory is the list of partitions that have files,
+ * and an ID directory so that a cancel or change can find the
+ * alarm's partition (and a cancelled alarm is skipped when its
+ * partition is read). Like the mem tier's, the directory is open
+ * addressing with linear probing, kept at most half full: a cold
+ * alarm costs one 16 byte slot, so 16 to 32 bytes of memory,
+ * against some 200 as an alarm_t.
+ */
+typedef struct disk_slot_tag {
+    int                 alarm_ID;
+    int                 client;
+    time_t              time;           //0: empty
+} disk_slot_t;
+
+typedef struct disk_tier_tag {
+    disk_slot_t         *slots;         //The ID directory
+    size_t              slot_size;      //A power of two
+    size_t              slot_count;
+    long                *partitions;    //Partitions with a file, unsorted
+    int                 partition_count;
+    int                 partition_size;
+    FILE                *file;          //Last partition appended to
+    long                file_partition;
+} disk_tier_t;
+
+static disk_tier_t *disk_tier (tenant_t *tenant) {
+    if (tenant->cold == NULL) {
+        disk_tier_t *disk = (disk_tier_t *)calloc(1, sizeof(disk_tier_t));
+        if (disk == NULL) {errno_abort("Allocate cold tier");}
+        tenant->cold = disk;
+    }
+    return (disk_tier_t *)tenant->cold;
+}
+
+static void disk_path (tenant_t *tenant, long partition, char *path, size_t size) {
+    snprintf(path, size, "%s/%ld.%s.%ld", cold_store, (long)getpid(), tenant->name, partition);
+}
+
+static void disk_append (tenant_t *tenant, long partition, const cold_record_t *record) {
+    disk_tier_t *disk = disk_tier(tenant);
+    char path[512];
+
+    if (disk->file == NULL || disk->file_partition != partition) {
+        if (disk->file != NULL)
+            fclose(disk->file);
+        disk_path(tenant, partition, path, sizeof(path));
+        disk->file = fopen(path, "ab");
+        if (disk->file == NULL) {errno_abort("Open cold partition");}
+        disk->file_partition = partition;
+
+        int known = 0;
+        for (int i = 0; i < disk->partition_count && !known; i++)
+            known = disk->partitions[i] == partition;
+        if (!known) {
+            if (disk->partition_count == disk->partition_size) {
+                disk->partition_size = disk->partition_size ? disk->partition_size * 2 : 16;
+                disk->partitions = (long *)realloc(disk->partitions, disk->partition_size * sizeof(long));
+                if (disk->partitions == NULL) {errno_abort("Allocate cold partitions");}
+            }
+            disk->partitions[disk->partition_count++] = partition;
+        }
+    }
+    if (fwrite(record, sizeof(*record), 1, disk->file) != 1) {errno_abort("Write cold partition");}
+}
+
+static size_t disk_slot_hash (disk_tier_t *disk, int alarm_ID) {
+    return ((unsigned)alarm_ID * 2654435761U) & (disk->slot_size - 1);
+}
+
+static void disk_slot_insert (disk_tier_t *disk, int alarm_ID, int client, time_t time) {
+    size_t i;
+
+    if ((disk->slot_count + 1) * 2 > disk->slot_size) {
+        disk_slot_t *old = disk->slots;
+        size_t old_size = disk->slot_size, start = 0;
+
+        disk->slot_size = old_size ? old_size * 2 : 1024;
+        disk->slots = (disk_slot_t *)calloc(disk->slot_size, sizeof(disk_slot_t));
+        if (disk->slots == NULL) {errno_abort("Allocate cold directory");}
+        disk->slot_count = 0;
+        //Start at an empty slot, so each probe run is moved in order and the newest entry for an ID stays last
+        while (start < old_size && old[start].time != 0)
+            start++;
+        for (i = 0; i < old_size; i++) {
+            disk_slot_t *slot = &old[(start + i) & (old_size - 1)];
+            if (slot->time != 0)
+                disk_slot_insert(disk, slot->alarm_ID, slot->client, slot->time);
+        }
+        free(old);
+    }
+    for (i = disk_slot_hash(disk, alarm_ID); disk->slots[i].time != 0; i = (i + 1) & (disk->slot_size - 1))
+        ;
+    disk->slots[i].alarm_ID = alarm_ID;
+    disk->slots[i].client = client;
+    disk->slots[i].time = time;
+    disk->slot_count++;
+}
+
+/*
+ * Find the directory slot of the newest cold alarm with an ID (and,
+ * if time is not zero, that time), as the ID index would: the last
+ * one in its probe run. Returns the slot, or -1.
+ */
+static long disk_slot_find (disk_tier_t *disk, int alarm_ID, time_t time) {
+    long found = -1;
+
+    if (disk->slot_size == 0)
+        return -1;
+    for (size_t i = disk_slot_hash(disk, alarm_ID); disk->slots[i].time != 0; i = (i + 1) & (disk->slot_size - 1))
+        if (disk->slots[i].alarm_ID == alarm_ID && (time == 0 || disk->slots[i].time == time))
+            found = (long)i;
+    return found;
+}
+
+static void disk_slot_remove (disk_tier_t *disk, size_t i) {
+    size_t mask = disk->slot_size - 1, j = i;
+
+    //Shift later members of the probe run back, so no run is broken
+    while (1) {
+        j = (j + 1) & mask;
+        if (disk->slots[j].time == 0)
+            break;
+        size_t home = disk_slot_hash(disk, disk->slots[j].alarm_ID);
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            disk->slots[i] = disk->slots[j];
+            i = j;
+        }
+    }
+    disk->slots[i].time = 0;
+    disk->slot_count--;
+}
+
+static void disk_put (tenant_t *tenant, const cold_record_t *record) {
+    disk_tier_t *disk = disk_tier(tenant);
+
+    disk_slot_insert(disk, record->alarm_ID, record->client, record->time);
+    disk_append(tenant, record->time / cold_partition, record);
+}
+
+/*
+ * Read a partition file, applying changes to the starts they refer
+ * to, and pass each alarm still in the directory to emit (removing
+ * it from the directory too, if take is set). Returns the number
+ * of records read.
+ */
+static long disk_read (tenant_t *tenant, long partition, int take, void (*emit) (tenant_t *, const cold_record_t *)) {
+    disk_tier_t *disk = disk_tier(tenant);
+    cold_record_t *records = NULL;
+    long count = 0, size = 0;
+    char path[512];
+    FILE *file;
+
+    if (disk->file != NULL && disk->file_partition == partition)
+        fflush(disk->file);
+    disk_path(tenant, partition, path, sizeof(path));
+    file = fopen(path, "rb");
+    if (file == NULL)
+        return 0;
+    while (1) {
+        if (count == size) {
+            size = size ? size * 2 : 256;
+            records = (cold_record_t *)realloc(records, size * sizeof(cold_record_t));
+            if (records == NULL) {errno_abort("Allocate cold records");}
+        }
+        if (fread(&records[count], sizeof(cold_record_t), 1, file) != 1)
+            break;
+        cold_record_t *record = &records[count];
+        if (record->op == COLD_CHANGE) {
+            for (long i = count; i-- > 0; ) {
+                if (records[i].op == COLD_START && records[i].alarm_ID == record->alarm_ID && records[i].time == record->time) {
+                    records[i].seconds = record->seconds;
+                    memcpy(records[i].message, record->message, sizeof(record->message));
+                    break;
+                }
+            }
+        }
+        count++;
+    }
+    fclose(file);
+
+    for (long i = 0; i < count; i++) {
+        long slot;
+        if (records[i].op != COLD_START || (slot = disk_slot_find(disk, records[i].alarm_ID, records[i].time)) < 0)
+            continue;
+        if (take)
+            disk_slot_remove(disk, slot);
+        emit(tenant, &records[i]);
+    }
+    free(records);
+    return count;
+}
+
+/*
+ * A partition file is read, restored, closed and unlinked whole, so
+ * limit only stops the load between files.
+ */
+static int disk_load (tenant_t *tenant, time_t until, long limit, void (*restore) (tenant_t *, const cold_record_t *)) {
+    disk_tier_t *disk = disk_tier(tenant);
+    long restored = 0;
+    char path[512];
+
+    for (int i = 0; i < disk->partition_count; ) {
+        long partition = disk->partitions[i];
+
+        if (partition * cold_partition >= until) {
+            i++;
+            continue;
+        }
+        if (limit > 0 && restored >= limit)
+            return 1;
+        restored += disk_read(tenant, partition, 1, restore);
+        if (disk->file != NULL && disk->file_partition == partition) {
+            fclose(disk->file);
+            disk->file = NULL;
+        }
+        disk_path(tenant, partition, path, sizeof(path));
+        unlink(path);
+        disk->partitions[i] = disk->partitions[--disk->partition_count];
+    }
+    return 0;
+}
+
+static int disk_cancel (tenant_t *tenant, int alarm_ID, cold_record_t *found) {
+    disk_tier_t *disk = disk_tier(tenant);
+    long slot = disk_slot_find(disk, alarm_ID, 0);
+
+    if (slot < 0)
+        return -1;
+    memset(found, 0, sizeof(*found));
+    found->alarm_ID = alarm_ID;
+    found->client = disk->slots[slot].client;
+    found->time = disk->slots[slot].time;
+    disk_slot_remove(disk, slot);
+    return 0;
+}
+
+static int disk_change (tenant_t *tenant, int alarm_ID, int seconds, const char *message, cold_record_t *found) {
+    disk_tier_t *disk = disk_tier(tenant);
+    long slot = disk_slot_find(disk, alarm_ID, 0);
+
+    if (slot < 0)
+        return -1;
+    memset(found, 0, sizeof(*found));
+    found->op = COLD_CHANGE;
+    found->alarm_ID = alarm_ID;
+    found->client = disk->slots[slot].client;
+    found->time = disk->slots[slot].time;
+    found->seconds = seconds;
+    strncpy(found->message, message, sizeof(found->message) - 1);
+    disk_append(tenant, found->time / cold_partition, found);
+    return 0;
+}
+
+static void disk_scan (tenant_t *tenant, void (*emit) (tenant_t *, const cold_record_t *)) {
+    disk_tier_t *disk = disk_tier(tenant);
+
+    for (int i = 0; i < disk->partition_count; i++)
+        disk_read(tenant, disk->partitions[i], 0, emit);
+}
+
+const cold_ops_t disk_cold = { disk_put, disk_load, disk_cancel, disk_change, disk_scan };
+
+/*
+ * In-memory cold tier (-C mem). Cold alarms are kept compressed,
+ * in blocks of up to COLD_BLOCK alarms sorted by due time, with a
+ * chain of blocks for each partition. In a block each alarm is a
+ * run of varints: its due time as a delta from the alarm before,
+ * its ID, seconds and client, and its type and message as indexes
+ * into tables where each distinct type and message is kept once.
+ * An alarm takes a dozen or so bytes in its block and one slot in
+ * the ID directory, against some 200 bytes as an alarm_t.
+ *
+ * The ID directory (open addressing, linear probing) maps the ID
+ * of each cold alarm to its partition, so that a cancel or change
+ * unpacks only the blocks of one partition.
+ */
+#define COLD_BLOCK      128
+
+typedef struct mem_block_tag {
+    struct mem_block_tag *next;         //Alarms due later
+    time_t              last;           //Due time of the last alarm in the block
+    int                 count;
+    size_t              length;         //Bytes of data
+    unsigned char       data[];
+} mem_block_t;
+
+typedef struct mem_partition_tag {
+    long                partition;
+    mem_block_t         *blocks;
+} mem_partition_t;
+
+typedef struct mem_entry_tag {          //One alarm, unpacked
+    time_t              time;
+    int                 alarm_ID;
+    int                 seconds;
+    int                 client;
+    int                 type;           //Index into types
+    int                 message;        //Index into messages
+} mem_entry_t;
+
+typedef struct mem_message_tag {
+    char                *text;          //NULL: on the free list
+    int                 refs;
+    int                 next;           //Hash chain, or free list; -1 ends it
+} mem_message_t;
+
+typedef struct mem_slot_tag {
+    int                 alarm_ID;
+    long                partition;      //-1: empty
+} mem_slot_t;
+
+typedef struct mem_tier_tag {
+    mem_partition_t     *partitions;    //Sorted by partition
+    int                 partition_count;
+    int                 partition_size;
+    mem_slot_t          *slots;         //The ID directory
+    size_t              slot_size;      //A power of two
+    size_t              slot_count;
+    char                (*types)[3];
+    int                 type_count;
+    int                 type_size;
+    mem_message_t       *messages;
+    int                 *message_buckets;   //message_size of them
+    int                 message_size;
+    int                 message_free;
+} mem_tier_t;
+
+static mem_tier_t *mem_tier (tenant_t *tenant) {
+    if (tenant->cold == NULL) {
+        mem_tier_t *mem = (mem_tier_t *)calloc(1, sizeof(mem_tier_t));
+        if (mem == NULL) {errno_abort("Allocate cold tier");}
+        mem->message_free = -1;
+        tenant->cold = mem;
+    }
+    return (mem_tier_t *)tenant->cold;
+}
+
+static unsigned char *put_varint (unsigned char *p, uint64_t value) {
+    while (value >= 0x80) {
+        *p++ = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    *p++ = (unsigned char)value;
+    return p;
+}
+
+static const unsigned char *get_varint (const unsigned char *p, uint64_t *value) {
+    int shift = 0;
+
+    *value = 0;
+    do {
+        *value |= (uint64_t)(*p & 0x7f) << shift;
+        shift += 7;
+    } while (*p++ & 0x80);
+    return p;
+}
+
+//Signed values are zigzag encoded, so that small negatives stay short
+#define zigzag(v)       (((uint64_t)(int64_t)(v) << 1) ^ (uint64_t)((int64_t)(v) >> 63))
+#define unzigzag(v)     ((int64_t)((v) >> 1) ^ -(int64_t)((v) & 1))
+
+static mem_block_t *mem_pack (const mem_entry_t *entries, int count) {
+    unsigned char buffer[COLD_BLOCK * 60], *p = buffer;
+    time_t prev = 0;
+    mem_block_t *block;
+
+    for (int i = 0; i < count; i++) {
+        p = put_varint(p, zigzag(entries[i].time - prev));
+        p = put_varint(p, zigzag(entries[i].alarm_ID));
+        p = put_varint(p, zigzag(entries[i].seconds));
+        p = put_varint(p, zigzag(entries[i].client));
+        p = put_varint(p, entries[i].type);
+        p = put_varint(p, entries[i].message);
+        prev = entries[i].time;
+    }
+    block = (mem_block_t *)malloc(sizeof(mem_block_t) + (p - buffer));
+    if (block == NULL) {errno_abort("Allocate cold block");}
+    block->next = NULL;
+    block->last = prev;
+    block->count = count;
+    block->length = p - buffer;
+    memcpy(block->data, buffer, block->length);
+    return block;
+}
+
+static void mem_unpack (const mem_block_t *block, mem_entry_t *entries) {
+    const unsigned char *p = block->data;
+    time_t prev = 0;
+    uint64_t v;
+
+    for (int i = 0; i < block->count; i++) {
+        p = get_varint(p, &v); prev += unzigzag(v); entries[i].time = prev;
+        p = get_varint(p, &v); entries[i].alarm_ID = (int)unzigzag(v);
+        p = get_varint(p, &v); entries[i].seconds = (int)unzigzag(v);
+        p = get_varint(p, &v); entries[i].client = (int)unzigzag(v);
+        p = get_varint(p, &v); entries[i].type = (int)v;
+        p = get_varint(p, &v); entries[i].message = (int)v;
+    }
+}
+
+static int mem_type (mem_tier_t *mem, const char *type) {
+    for (int i = 0; i < mem->type_count; i++)
+        if (strncmp(mem->types[i], type, 3) == 0)
+            return i;
+    if (mem->type_count == mem->type_size) {
+        mem->type_size = mem->type_size ? mem->type_size * 2 : 16;
+        mem->types = realloc(mem->types, mem->type_size * sizeof(*mem->types));
+        if (mem->types == NULL) {errno_abort("Allocate cold types");}
+    }
+    memcpy(mem->types[mem->type_count], type, 3);
+    return mem->type_count++;
+}
+
+static unsigned mem_message_hash (const char *text) {
+    unsigned hash = 2166136261U;
+
+    while (*text)
+        hash = (hash ^ (unsigned char)*text++) * 16777619U;
+    return hash;
+}
+
+/*
+ * Find or add a message, taking a reference to it.
+ */
+static int mem_message (mem_tier_t *mem, const char *text) {
+    int i;
+
+    if (mem->message_size > 0) {
+        for (i = mem->message_buckets[mem_message_hash(text) % mem->message_size]; i >= 0; i = mem->messages[i].next)
+            if (strcmp(mem->messages[i].text, text) == 0) {
+                mem->messages[i].refs++;
+                return i;
+            }
+    }
+    if (mem->message_free < 0) {
+        //Grow, put the new entries on the free list and rebuild the hash chains
+        int old_size = mem->message_size;
+
+        mem->message_size = old_size ? old_size * 2 : 256;
+        mem->messages = realloc(mem->messages, mem->message_size * sizeof(mem_message_t));
+        mem->message_buckets = realloc(mem->message_buckets, mem->message_size * sizeof(int));
+        if (mem->messages == NULL || mem->message_buckets == NULL) {errno_abort("Allocate cold messages");}
+        for (i = mem->message_size - 1; i >= old_size; i--) {
+            mem->messages[i].text = NULL;
+            mem->messages[i].next = mem->message_free;
+            mem->message_free = i;
+        }
+        for (i = 0; i < mem->message_size; i++)
+            mem->message_buckets[i] = -1;
+        for (i = 0; i < old_size; i++) {
+            if (mem->messages[i].text == NULL)
+                continue;
+            unsigned bucket = mem_message_hash(mem->messages[i].text) % mem->message_size;
+            mem->messages[i].next = mem->message_buckets[bucket];
+            mem->message_buckets[bucket] = i;
+        }
+    }
+    i = mem->message_free;
+    mem->message_free = mem->messages[i].next;
+    mem->messages[i].text = strdup(text);
+    if (mem->messages[i].text == NULL) {errno_abort("Allocate cold message");}
+    mem->messages[i].refs = 1;
+    unsigned bucket = mem_message_hash(text) % mem->message_size;
+    mem->messages[i].next = mem->message_buckets[bucket];
+    mem->message_buckets[bucket] = i;
+    return i;
+}
+
+static void mem_message_release (mem_tier_t *mem, int i) {
+    int *last;
+
+    if (--mem->messages[i].refs > 0)
+        return;
+    last = &mem->message_buckets[mem_message_hash(mem->messages[i].text) % mem->message_size];
+    while (*last != i)
+        last = &mem->messages[*last].next;
+    *last = mem->messages[i].next;
+    free(mem->messages[i].text);
+    mem->messages[i].text = NULL;
+    mem->messages[i].next = mem->message_free;
+    mem->message_free = i;
+}
+
+static size_t mem_slot_hash (mem_tier_t *mem, int alarm_ID) {
+    return ((unsigned)alarm_ID * 2654435761U) & (mem->slot_size - 1);
+}
+
+static void mem_slot_insert (mem_tier_t *mem, int alarm_ID, long partition) {
+    size_t i;
+
+    if ((mem->slot_count + 1) * 2 > mem->slot_size) {
+        mem_slot_t *old = mem->slots;
+        size_t old_size = mem->slot_size;
+
+        mem->slot_size = old_size ? old_size * 2 : 1024;
+        mem->slots = (mem_slot_t *)malloc(mem->slot_size * sizeof(mem_slot_t));
+        if (mem->slots == NULL) {errno_abort("Allocate cold directory");}
+        for (i = 0; i < mem->slot_size; i++)
+            mem->slots[i].partition = -1;
+        mem->slot_count = 0;
+        for (i = 0; i < old_size; i++)
+            if (old[i].partition >= 0)
+                mem_slot_insert(mem, old[i].alarm_ID, old[i].partition);
+        free(old);
+    }
+    for (i = mem_slot_hash(mem, alarm_ID); mem->slots[i].partition >= 0; i = (i + 1) & (mem->slot_size - 1))
+        ;
+    mem->slots[i].alarm_ID = alarm_ID;
+    mem->slots[i].partition = partition;
+    mem->slot_count++;
+}
+
+/*
+ * Find the directory slot of an alarm (in a given partition, unless
+ * partition is -1). Returns the slot, or -1.
+ */
+static long mem_slot_find (mem_tier_t *mem, int alarm_ID, long partition) {
+    if (mem->slot_size == 0)
+        return -1;
+    for (size_t i = mem_slot_hash(mem, alarm_ID); mem->slots[i].partition >= 0; i = (i + 1) & (mem->slot_size - 1))
+        if (mem->slots[i].alarm_ID == alarm_ID && (partition < 0 || mem->slots[i].partition == partition))
+            return (long)i;
+    return -1;
+}
+
+static void mem_slot_remove (mem_tier_t *mem, size_t i) {
+    size_t mask = mem->slot_size - 1, j = i;
+
+    //Shift later members of the probe run back, so no run is broken
+    while (1) {
+        j = (j + 1) & mask;
+        if (mem->slots[j].partition < 0)
+            break;
+        size_t home = mem_slot_hash(mem, mem->slots[j].alarm_ID);
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            mem->slots[i] = mem->slots[j];
+            i = j;
+        }
+    }
+    mem->slots[i].partition = -1;
+    mem->slot_count--;
+}
+
+static mem_partition_t *mem_partition (mem_tier_t *mem, long partition, int create) {
+    int low = 0, high = mem->partition_count;
+
+    while (low < high) {
+        int middle = (low + high) / 2;
+        if (mem->partitions[middle].partition < partition)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    if (low < mem->partition_count && mem->partitions[low].partition == partition)
+        return &mem->partitions[low];
+    if (!create)
+        return NULL;
+    if (mem->partition_count == mem->partition_size) {
+        mem->partition_size = mem->partition_size ? mem->partition_size * 2 : 16;
+        mem->partitions = realloc(mem->partitions, mem->partition_size * sizeof(mem_partition_t));
+        if (mem->partitions == NULL) {errno_abort("Allocate cold partitions");}
+    }
+    memmove(&mem->partitions[low + 1], &mem->partitions[low], (mem->partition_count - low) * sizeof(mem_partition_t));
+    mem->partition_count++;
+    mem->partitions[low].partition = partition;
+    mem->partitions[low].blocks = NULL;
+    return &mem->partitions[low];
+}
+
+static void mem_record (mem_tier_t *mem, const mem_entry_t *entry, cold_record_t *record) {
+    memset(record, 0, sizeof(*record));
+    record->op = COLD_START;
+    record->alarm_ID = entry->alarm_ID;
+    record->seconds = entry->seconds;
+    record->client = entry->client;
+    record->time = entry->time;
+    memcpy(record->type, mem->types[entry->type], 3);
+    strncpy(record->message, mem->messages[entry->message].text, sizeof(record->message) - 1);
+}
+
+static void mem_put (tenant_t *tenant, const cold_record_t *record) {
+    mem_tier_t *mem = mem_tier(tenant);
+    long partition = record->time / cold_partition;
+    mem_partition_t *part = mem_partition(mem, partition, 1);
+    mem_entry_t entries[COLD_BLOCK + 1], entry;
+    mem_block_t **last, *block;
+    int count, i;
+
+    entry.time = record->time;
+    entry.alarm_ID = record->alarm_ID;
+    entry.seconds = record->seconds;
+    entry.client = record->client;
+    entry.type = mem_type(mem, record->type);
+    entry.message = mem_message(mem, record->message);
+
+    //The block the alarm falls in: the first that ends at or after it, or the last
+    last = &part->blocks;
+    while (*last != NULL && (*last)->next != NULL && (*last)->last < entry.time)
+        last = &(*last)->next;
+    block = *last;
+    count = 0;
+    if (block != NULL) {
+        mem_unpack(block, entries);
+        count = block->count;
+    }
+    for (i = count; i > 0 && entries[i - 1].time > entry.time; i--)
+        entries[i] = entries[i - 1];
+    entries[i] = entry;
+    count++;
+
+    //Repack, splitting a full block in two
+    mem_block_t *next = block != NULL ? block->next : NULL;
+    if (count > COLD_BLOCK) {
+        mem_block_t *second = mem_pack(entries + count / 2, count - count / 2);
+        second->next = next;
+        next = second;
+        *last = mem_pack(entries, count / 2);
+    } else
+        *last = mem_pack(entries, count);
+    (*last)->next = next;
+    free(block);
+    mem_slot_insert(mem, entry.alarm_ID, partition);
+}
+
+static void mem_drop_partition (mem_tier_t *mem, mem_partition_t *part) {
+    int i = part - mem->partitions;
+
+    memmove(part, part + 1, (mem->partition_count - i - 1) * sizeof(mem_partition_t));
+    mem->partition_count--;
+}
+
+/*
+ * Blocks are taken off their partition one at a time, so limit is
+ * checked between blocks.
+ */
+static int mem_load (tenant_t *tenant, time_t until, long limit, void (*restore) (tenant_t *, const cold_record_t *)) {
+    mem_tier_t *mem = mem_tier(tenant);
+    mem_entry_t entries[COLD_BLOCK];
+    cold_record_t record;
+    long restored = 0;
+
+    while (mem->partition_count > 0 && mem->partitions[0].partition * cold_partition < until) {
+        mem_partition_t *part = &mem->partitions[0];
+        mem_block_t *block;
+
+        if (limit > 0 && restored >= limit)
+            return 1;
+        block = part->blocks;
+        part->blocks = block->next;
+        mem_unpack(block, entries);
+        for (int i = 0; i < block->count; i++) {
+            mem_record(mem, &entries[i], &record);
+            mem_slot_remove(mem, mem_slot_find(mem, entries[i].alarm_ID, part->partition));
+            mem_message_release(mem, entries[i].message);
+            restore(tenant, &record);
+        }
+        restored += block->count;
+        free(block);
+        if (part->blocks == NULL)
+            mem_drop_partition(mem, part);
+    }
+    return 0;
+}
+
+/*
+ * Find a cold alarm by ID: its partition, its block and its place
+ * in the block, which is unpacked into entries. Returns the place,
+ * or -1.
+ */
+static int mem_find (mem_tier_t *mem, int alarm_ID, mem_partition_t **part, mem_block_t ***last, mem_entry_t *entries) {
+    long slot = mem_slot_find(mem, alarm_ID, -1);
+
+    if (slot < 0)
+        return -1;
+    *part = mem_partition(mem, mem->slots[slot].partition, 0);
+    for (*last = &(*part)->blocks; **last != NULL; *last = &(**last)->next) {
+        mem_unpack(**last, entries);
+        for (int i = 0; i < (**last)->count; i++)
+            if (entries[i].alarm_ID == alarm_ID)
+                return i;
+    }
+    return -1;
+}
+
+static int mem_cancel (tenant_t *tenant, int alarm_ID, cold_record_t *found) {
+    mem_tier_t *mem = mem_tier(tenant);
+    mem_entry_t entries[COLD_BLOCK];
+    mem_partition_t *part;
+    mem_block_t **last, *block;
+    int i;
+
+    if ((i = mem_find(mem, alarm_ID, &part, &last, entries)) < 0)
+        return -1;
+    mem_record(mem, &entries[i], found);
+    mem_slot_remove(mem, mem_slot_find(mem, alarm_ID, part->partition));
+    mem_message_release(mem, entries[i].message);
+
+    block = *last;
+    memmove(&entries[i], &entries[i + 1], (block->count - i - 1) * sizeof(mem_entry_t));
+    if (block->count > 1) {
+        *last = mem_pack(entries, block->count - 1);
+        (*last)->next = block->next;
+    } else
+        *last = block->next;
+    free(block);
+    if (part->blocks == NULL)
+        mem_drop_partition(mem, part);
+    return 0;
+}
+
+static int mem_change (tenant_t *tenant, int alarm_ID, int seconds, const char *message, cold_record_t *found) {
+    mem_tier_t *mem = mem_tier(tenant);
+    mem_entry_t entries[COLD_BLOCK];
+    mem_partition_t *part;
+    mem_block_t **last, *block;
+    int i;
+
+    if ((i = mem_find(mem, alarm_ID, &part, &last, entries)) < 0)
+        return -1;
+    block = *last;
+    mem_message_release(mem, entries[i].message);
+    entries[i].message = mem_message(mem, message);
+    entries[i].seconds = seconds;
+    *last = mem_pack(entries, block->count);
+    (*last)->next = block->next;
+    free(block);
+    mem_record(mem, &entries[i], found);
+    found->op = COLD_CHANGE;
+    return 0;
+}
+
+static void mem_scan (tenant_t *tenant, void (*emit) (tenant_t *, const cold_record_t *)) {
+    mem_tier_t *mem = mem_tier(tenant);
+    mem_entry_t entries[COLD_BLOCK];
+    cold_record_t record;
+
+    for (int p = 0; p < mem->partition_count; p++) {
+        for (mem_block_t *block = mem->partitions[p].blocks; block != NULL; block = block->next) {
+            mem_unpack(block, entries);
+            for (int i = 0; i < block->count; i++) {
+                mem_record(mem, &entries[i], &record);
+                emit(tenant, &record);
+            }
+        }
+    }
+}
+
+const cold_ops_t mem_cold = { mem_put, mem_load, mem_cancel, mem_change, mem_scan };
+
+void insert_alarm (alarm_t *alarm);
+static void hot_merge (tenant_t *tenant, alarm_t **expired, int *expired_count);
+extern int alarm_quantum;
+static void alarm_quantum_break (tenant_t *tenant, alarm_t **expired, int *expired_count);
+
+/*
+ * Fill in a stand-in alarm_t for a cold alarm, for the code that
+ * reports on alarms (repl_log, shm_notify) without owning them.
+ */
+static void cold_alarm (tenant_t *tenant, const cold_record_t *record, alarm_t *alarm) {
+    memset(alarm, 0, sizeof(*alarm));
+    alarm->seconds = record->seconds;
+    alarm->time = record->time;
+    memcpy(alarm->type, record->type, sizeof(alarm->type));
+    memcpy(alarm->message, record->message, sizeof(alarm->message));
+    alarm->alarm_ID = record->alarm_ID;
+    alarm->client = record->client;
+    alarm->tenant = tenant;
+}
+
+/*
+ * Bring a cold alarm back into the alarm list. Called with alarm_mutex
+ * held, by the cold tier.
+ */
+static void cold_restore (tenant_t *tenant, const cold_record_t *record) {
+    alarm_t *alarm = alarm_create(tenant);
+
+    alarm->seconds = record->seconds;
+    alarm->time = record->time;
+    memcpy(alarm->type, record->type, sizeof(alarm->type));
+    memcpy(alarm->message, record->message, sizeof(alarm->message));
+    alarm->alarm_ID = record->alarm_ID;
+    alarm->client = record->client;
+    insert_alarm(alarm);
+    index_insert(alarm);
+    tenant->cold_count--;
+}
+
+/*
+ * Hand an alarm to the cold tier if it is due beyond the horizon.
+ * Returns 1 if it did (the caller still owns the alarm_t and frees
+ * it), 0 if the alarm belongs in the alarm list. Called with alarm_mutex
+ * held.
+ */
+int cold_spill (alarm_t *alarm) {
+    tenant_t *tenant = alarm->tenant;
+    cold_record_t record;
+
+    if (cold_ops == NULL)
+        return 0;
+    if (tenant->cold_until == 0) {
+        time_t horizon = clock_now() + cold_horizon;
+        tenant->cold_until = (horizon / cold_partition + 1) * cold_partition;
+    }
+    if (alarm->time < tenant->cold_until)
+        return 0;
+    memset(&record, 0, sizeof(record));
+    record.op = COLD_START;
+    record.alarm_ID = alarm->alarm_ID;
+    record.seconds = alarm->seconds;
+    record.client = alarm->client;
+    record.time = alarm->time;
+    memcpy(record.type, alarm->type, sizeof(record.type));
+    memcpy(record.message, alarm->message, sizeof(record.message));
+    cold_ops->put(tenant, &record);
+    tenant->cold_count++;
+    return 1;
+}
+
+/*
+ * Page in every partition the horizon has reached, a quantum (-U)
+ * at a time. Called by the alarm thread with alarm_mutex held and
+ * scanning set, so the alarms restored wait in incoming for
+ * hot_merge rather than each being inserted into the hot array.
+ */
+void cold_page_in (tenant_t *tenant, time_t now, alarm_t **expired, int *expired_count) {
+    if (cold_ops == NULL || tenant->cold_until == 0 || now + cold_horizon < tenant->cold_until)
+        return;
+    tenant->cold_until = ((now + cold_horizon) / cold_partition + 1) * cold_partition;
+    while (tenant->cold_count > 0 && cold_ops->load(tenant, tenant->cold_until, alarm_quantum, cold_restore))
+        alarm_quantum_break(tenant, expired, expired_count);
+}
+
+/*
+* Display Threads
+*/
+/*
+ * Display bookkeeping. All of these are called with display_mutex
+ * held.
+ */
+static display_type_t *display_type (tenant_t *tenant, const char *type, int create) {
+    display_type_t *unused = NULL;
+
+    for (int i = 0; i < MAX_DISPLAYS; i++) {
+        display_type_t *entry = &tenant->display_types[i];
+        if (entry->all == 0) {
+            if (unused == NULL)
+                unused = entry;
+        } else if (strcmp(entry->type, type) == 0) {
+            return entry;
+        }
+    }
+    if (!create || unused == NULL)
+        return NULL;
+    strcpy(unused->type, type);
+    unused->settle = 0;
+    return unused;
+}
+
+static void display_line_render (display_t *display, int slot) {
+    display_line_t *line = &display->lines[slot];
+    alarm_t *alarm = display->assigned_alarm[slot];
+
+    line->revision = atomic_load(&alarm->revision);
+    line->prefix = snprintf(line->text, sizeof(line->text), "Alarm(%d) Message PERIODICALLY PRINTED BY Display Thread (%lu) at ", alarm->alarm_ID, display->threadid);
+    line->suffix_length = snprintf(line->suffix, sizeof(line->suffix), ": %s %d %s\n", alarm->type, alarm->seconds, alarm->message);
+}
+
+/*
+ * Add a slot's periodic line to batch, for the tick at time when, or
+ * with the time from the clock cache if when is -1.
+ */
+static void display_line_print (display_t *display, int slot, out_batch_t *batch, time_t when) {
+    display_line_t *line = &display->lines[slot];
+    char *p = line->text + line->prefix;
+
+    if (line->revision != atomic_load(&display->assigned_alarm[slot]->revision))
+        display_line_render(display, slot);
+    if (when == -1)
+        p += clock_cache_text(p);
+    else
+        p += sprintf(p, "%ld", (long)when);
+    memcpy(p, line->suffix, line->suffix_length);
+    p += line->suffix_length;
+    batch_periodic(batch, display->type, display->tenant, display->assigned_alarm[slot]->alarm_ID, line->text, p - line->text);
+}
+
+static void display_slot_fill (display_t *display, int slot, alarm_t *alarm) {
+    display->assigned_alarm[slot] = alarm;
+    display_line_render(display, slot);
+    display->occupied |= 1U << slot;
+    if (display->occupied == DISPLAY_FULL)
+        display_type(display->tenant, display->type, 0)->free &= ~(1U << display->index);
+}
+
+static void display_slot_clear (display_t *display, int slot) {
+    display->assigned_alarm[slot] = NULL;
+    display->occupied &= ~(1U << slot);
+    display_type(display->tenant, display->type, 0)->free |= 1U << display->index;
+}
+
+/*
+ * Catch-up policy (-K once|all|skip[:limit]). A display that wakes up
+ * a period or more late (the process was stopped, or starved of CPU)
+ * has missed ticks. With once, it prints each alarm once and starts
+ * its period again from now; with all, it prints a line for every
+ * tick it missed, stamped with the tick's time (at most limit of
+ * them if limit is set, and never more than 64); with skip, it prints nothing for the
+ * missed ticks, and waits for the next tick in step with the ones
+ * before. The limit also bounds the alarms the alarm thread expires
+ * in one pass, so that a backlog of overdue alarms is worked off a
+ * piece at a time, releasing alarm_mutex in between.
+ */
+#define CATCHUP_ONCE    0
+#define CATCHUP_ALL     1
+#define CATCHUP_SKIP    2
+
+int catchup_policy = CATCHUP_ONCE;                          //-K: missed display ticks
+int catchup_limit = 0;                                      //-K: per pass, 0 for no limit
+
+void *display_thread (void *arg) {
+   display_t *display_thread = (display_t*) arg;
+   tenant_t *tenant = display_thread->tenant;
+   out_batch_t batch;
+   time_t ticks[64];
+   int status;
+
+   batch_init(&batch);
+
+   //Wait for the creator to publish the display, which it does after pthread_create returns
+   status = engine_lock (&tenant->display_mutex);
+   if (status != 0)
+       err_abort (status, "Lock mutex");
+   while (display_thread->index < 0) {
+       status = pthread_cond_wait (&tenant->display_ready, &tenant->display_mutex);
+       if (status != 0)
+           err_abort (status, "Wait for display");
+   }
+   status = engine_unlock (&tenant->display_mutex);
+   if (status != 0)
+       err_abort (status, "Unlock mutex");
+
+   while(1){
+        //The ticks due since the last pass: usually just one, now
+        time_t tick_now = clock_now();
+        long missed = tick_now > display_thread->next_tick ? (tick_now - display_thread->next_tick) / DISPLAY_PERIOD : 0;
+        int tick_count = 0;
+
+        if (catchup_policy == CATCHUP_ONCE) {
+            ticks[tick_count++] = -1;
+            display_thread->next_tick = tick_now + DISPLAY_PERIOD;
+        } else if (missed == 0) {
+            ticks[tick_count++] = -1;
+            display_thread->next_tick += DISPLAY_PERIOD;        //Stay in step
+        } else {
+            long first = catchup_policy == CATCHUP_SKIP ? missed + 1 : 0;
+            long most = catchup_limit > 0 && catchup_limit < 64 ? catchup_limit : 64;
+
+            if (missed + 1 - first > most)
+                first = missed + 1 - most;
+            for (long k = first; k <= missed; k++)
+                ticks[tick_count++] = display_thread->next_tick + k * DISPLAY_PERIOD;
+            display_thread->next_tick += (missed + 1) * DISPLAY_PERIOD;
+        }
+
+        // Lock the mutex to safely modify shared data structures
+        status = engine_lock (&tenant->display_mutex);
+        if (status != 0)
+            err_abort (status, "Lock mutex");
+        
+        
+        int active_alarm = 0;
+
+        // Check each alarm in the display thread
+        for(int i = 0; i < DISPLAY_SLOTS; i++){
+            alarm_t *alarm = display_thread->assigned_alarm[i];
+            
+            if(display_thread->occupied & 1U << i){     //Alarm exists to analyze
+                time_t now = clock_now();
+                int state = atomic_load(&alarm->state);
+
+                //Cancelled alarm (the slot's reference keeps it readable until released)
+                if(state == ALARM_CANCELLED){
+                    batch_typed(&batch, display_thread->type, "Alarm(%d) Cancelled; Display Thread (%lu) Stopped Printing Alarm Message at %ld: %s %d %s\n", alarm->alarm_ID, display_thread->threadid, now, alarm->type, alarm->seconds, alarm->message);
+                    display_slot_clear(display_thread, i);      //Clear the cancelled alarm
+                    alarm_release(alarm);
+
+                //Expired alarm
+                }else if(state == ALARM_FIRING || now >= alarm->time){
+                    batch_typed(&batch, display_thread->type, "Alarm(%d) Expired; Display Thread (%lu) Stopped Printing Alarm Message at %ld: %s %d %s\n", alarm->alarm_ID, display_thread->threadid, now, alarm->type, alarm->seconds, alarm->message);
+                    display_slot_clear(display_thread, i);      //Clear the expired alarm
+                    alarm_release(alarm);
+                
+                //Alarm does not expire and print the periodic message
+                }else {
+                    for (int k = 0; k < tick_count; k++)
+                        display_line_print(display_thread, i, &batch, ticks[k]);
+                    active_alarm++;
+                }
+            }
+        }
+        
+        //No alarm in the display thread, terminate the thread
+        if(active_alarm == 0) {
+            batch_typed(&batch, display_thread->type, "Display Thread Terminated (%lu) at %ld\n", display_thread->threadid, clock_now());
+
+            //Remove the thread from the display array so nobody looks it up after it is freed
+            display_type_t *entry = display_type(tenant, display_thread->type, 0);
+            entry->all &= ~(1U << display_thread->index);
+            entry->free &= ~(1U << display_thread->index);
+            tenant->display_used &= ~(1U << display_thread->index);
+            tenant->display_threads[display_thread->index] = NULL;
+            tenant->display_thread_count--;
+            status = engine_unlock (&tenant->display_mutex);
+            if (status != 0)
+                err_abort (status, "Unlock mutex");
+            batch_emit(&batch);
+            free(display_thread);
+            clock_thread_exit();
+            pthread_exit(NULL);
+        }
+
+        // Unlock the mutex after modifying shared data structures
+        status = engine_unlock (&tenant->display_mutex);
+        if (status != 0)
+             err_abort (status, "Unlock mutex");
+        batch_emit(&batch);
+        
+        //Sleep until the next tick before re-checking the display thread
+        tick_now = clock_now();
+        clock_sleep(display_thread->next_tick > tick_now ? (int)(display_thread->next_tick - tick_now) : 0);
+   }
+}
+
+/*
+* Create a display thread function. Called with no lock held, so a
+* slow pthread_create holds up no one else; the display does nothing
+* until display_publish() gives it a place in the display array.
+*/
+display_t *create_display_thread(tenant_t *tenant, char *type, out_batch_t *batch) {
+    // Create new display
+    display_t *new_thread = (display_t*) malloc(sizeof(display_t));
+    if (new_thread == NULL) {
+        batch_error(batch, "Error: Could not allocate memory for new display thread.\n");
+        return NULL;
+    }
+
+    //Set the thread base on alarm type
+    strcpy(new_thread->type, type);
+    new_thread->occupied = 0;
+    new_thread->assigned_alarm[0] = NULL;
+    new_thread->assigned_alarm[1] = NULL;
+    new_thread->tenant = tenant;
+    new_thread->index = -1;
+    new_thread->next_tick = clock_now();
+
+    //Create the thread
+    clock_thread_start();
+    int status = pthread_create(&new_thread->threadid, NULL, display_thread, new_thread);
+    if(status != 0){
+        free(new_thread);
+        err_abort(status, "Create display Thread");
+    }
+    return new_thread;
+}
+
+/*
+ * Add a new display to the array of threads, in its first free slot,
+ * as a display of its type with room, and let it start. Called with
+ * display_mutex held.
+ */
+static void display_publish (display_t *display) {
+    tenant_t *tenant = display->tenant;
+    display_type_t *entry = display_type(tenant, display->type, 1);
+    int status;
+
+    display->index = ffs(~tenant->display_used) - 1;
+    tenant->display_threads[display->index] = display;
+    tenant->display_used |= 1U << display->index;
+    entry->all |= 1U << display->index;
+    entry->free |= 1U << display->index;
+    status = pthread_cond_broadcast(&tenant->display_ready);
+    if (status != 0) {err_abort(status, "Signal display");}
+}
+
+/*
+* Assign Alarm to the Right Thread, adding its messages to batch
+*/
+void assign_alarm_to_display_thread(alarm_t *new_alarm, out_batch_t *batch) {
+
+    //Initialize variables and pointers
+    display_t *target_thread = NULL;
+    int status;
+    alarm_t *temp_alarm = new_alarm;
+    tenant_t *tenant = new_alarm->tenant;
+
+    // Lock the mutex to safely modify shared data structures
+    status = engine_lock(&tenant->display_mutex);
+    if (status != 0) {
+        err_abort(status, "Lock mutex");
+    }
+
+    //Find the target thread for the alarm based on their type and the display capacity: the lowest display of the type with room
+    display_type_t *entry = display_type(tenant, temp_alarm->type, 0);
+    if(entry != NULL && entry->free != 0)
+        target_thread = tenant->display_threads[ffs(entry->free) - 1];
+
+    /*
+     * No display with room: create one (creation fails once the
+     * display limit is reached). The display is counted against the
+     * limit before display_mutex is let go for pthread_create, and
+     * published once it is taken back.
+     */
+    if(target_thread == NULL && tenant->display_thread_count < quota_displays){
+        tenant->display_thread_count++;
+        status = engine_unlock(&tenant->display_mutex);
+        if (status != 0) {err_abort(status, "Unlock mutex");}
+        display_t *new_thread = create_display_thread(tenant, temp_alarm->type, batch);
+        status = engine_lock(&tenant->display_mutex);
+        if (status != 0) {err_abort(status, "Lock mutex");}
+
+        if(new_thread == NULL){
+            tenant->display_thread_count--;
+        }else{
+            int type_found = display_type(tenant, temp_alarm->type, 0) != NULL;
+
+            display_publish(new_thread);
+            target_thread = new_thread;
+            batch_typed(batch, temp_alarm->type, "%s New Display Thread (%lu) Created at %ld: %s %d %s\n", type_found ? "Additional" : "First", target_thread->threadid, clock_now(), temp_alarm->type, temp_alarm->seconds, temp_alarm->message);
+        }
+    }
+
+    //Assign the alarm to the first free slot of the target thread, which takes a reference to it
+    if(target_thread != NULL){
+        atomic_fetch_add(&temp_alarm->refs, 1);
+        display_slot_fill(target_thread, ffs(~target_thread->occupied & DISPLAY_FULL) - 1, temp_alarm);
+        batch_typed(batch, temp_alarm->type, "Alarm (%d) Assigned to Display Thread (%lu) at %ld: %s %d %s\n", temp_alarm->alarm_ID, target_thread->threadid, clock_now(), temp_alarm->type, temp_alarm->seconds, temp_alarm->message); 
+    } else {
+        batch_error(batch, "Error: Could not create new display thread.\n");
+    }
+
+    // Unlock the mutex after modifying shared data structures
+    status = engine_unlock(&tenant->display_mutex);
+    if (status != 0) {
+        err_abort(status, "Unlock mutex");
+    }
+}
+
+/*
+ * Display rebalancing (-B interval[:checks]). As alarms expire, the
+ * displays of a type are left half empty, each printing one alarm
+ * where one display could print two. Every interval seconds the
+ * rebalancer thread looks for types with two or more half-empty
+ * displays, and moves the alarm of the highest-numbered one to the
+ * lowest-numbered one; the display that was emptied terminates on
+ * its next wakeup. So that alarms are not shuffled back and forth
+ * as they come and go, a type must be found sparse on checks
+ * consecutive looks before anything is moved.
+ */
+int rebalance_interval = 5;                                 //-B: seconds between checks, 0 for none
+int rebalance_checks = 2;                                   //-B: consecutive sparse checks before moving
+
+void *rebalance_thread (void *arg) {
+    tenant_t *tenant = (tenant_t *)arg;
+    out_batch_t batch;
+    int status;
+
+    batch_init(&batch);
+    while (1) {
+        clock_sleep(rebalance_interval);
+        status = engine_lock(&tenant->display_mutex);
+        if (status != 0) {err_abort(status, "Lock mutex");}
+
+        for (int t = 0; t < MAX_DISPLAYS; t++) {
+            display_type_t *entry = &tenant->display_types[t];
+            unsigned half = 0;
+
+            //Displays of the type printing one alarm
+            for (unsigned free = entry->free; free != 0; free &= free - 1) {
+                int index = ffs(free) - 1;
+                if (__builtin_popcount(tenant->display_threads[index]->occupied) == 1)
+                    half |= 1U << index;
+            }
+            if (__builtin_popcount(half) < 2) {
+                entry->settle = 0;
+                continue;
+            }
+            if (++entry->settle < rebalance_checks)
+                continue;
+            entry->settle = 0;
+
+            while (__builtin_popcount(half) >= 2) {
+                display_t *target = tenant->display_threads[ffs(half) - 1];
+                display_t *source = tenant->display_threads[31 - __builtin_clz(half)];
+                int slot = ffs(source->occupied) - 1;
+                alarm_t *alarm = source->assigned_alarm[slot];
+
+                half &= ~(1U << source->index);
+                if (!alarm_live(alarm))
+                    continue;           //Its display is about to let go of it anyway
+                half &= ~(1U << target->index);
+
+                //The display's reference to the alarm moves with it
+                display_slot_clear(source, slot);
+                display_slot_fill(target, ffs(~target->occupied & DISPLAY_FULL) - 1, alarm);
+                batch_typed(&batch, alarm->type, "Alarm (%d) Moved from Display Thread (%lu) to Display Thread (%lu) at %ld: %s %d %s\n", alarm->alarm_ID, source->threadid, target->threadid, clock_now(), alarm->type, alarm->seconds, alarm->message);
+            }
+        }
+
+        status = engine_unlock(&tenant->display_mutex);
+        if (status != 0) {err_abort(status, "Unlock mutex");}
+        batch_emit(&batch);
+    }
+}
+
+/*
+ * Queue work for the tenant's executor thread, passing it the
+ * caller's reference to the alarm. On the virtual clock an idle
+ * executor is counted as running again from here, so that time
+ * cannot move on until it has done the work.
+ */
+static void expiry_queue (tenant_t *tenant, alarm_t *alarm, int kind, time_t when) {
+    int status;
+
+    status = engine_lock (&tenant->executor_mutex);
+    if (status != 0)
+        err_abort (status, "Lock executor mutex");
+    if (tenant->expiry_count == tenant->expiry_size) {
+        tenant->expiry_size = tenant->expiry_size ? tenant->expiry_size * 2 : 64;
+        tenant->expiries = (expiry_t *)realloc(tenant->expiries, tenant->expiry_size * sizeof(expiry_t));
+        if (tenant->expiries == NULL) {errno_abort("Allocate executor queue");}
+    }
+    tenant->expiries[tenant->expiry_count].alarm = alarm;
+    tenant->expiries[tenant->expiry_count].kind = kind;
+    tenant->expiries[tenant->expiry_count].when = when;
+    if (tenant->expiry_count++ == 0) {
+        if (!tenant->executing) {
+            tenant->executing = 1;
+            clock_thread_start();
+        }
+        status = pthread_cond_signal (&tenant->executor_cond);
+        if (status != 0)
+            err_abort (status, "Signal executor");
+    }
+    status = engine_unlock (&tenant->executor_mutex);
+    if (status != 0)
+        err_abort (status, "Unlock executor mutex");
+}
+
+/*
+ * The executor thread's start routine. It takes the whole queue at
+ * a time and does the work with no engine lock held but the
+ * display_mutex taken by assign_alarm_to_display_thread, so a slow
+ * pthread_create or a blocked output channel holds up only the
+ * executor, never the alarm thread's passes.
+ */
+void *executor_thread (void *arg)
+{
+    tenant_t *tenant = (tenant_t *)arg;
+    expiry_t *work = NULL, *spare;
+    size_t work_count, work_size = 0, spare_size;
+    out_batch_t batch;
+    int status;
+
+    batch_init(&batch);
+    while (1) {
+        status = engine_lock (&tenant->executor_mutex);
+        if (status != 0)
+            err_abort (status, "Lock executor mutex");
+        while (tenant->expiry_count == 0) {
+            if (tenant->executing) {
+                tenant->executing = 0;
+                clock_thread_exit();
+            }
+            status = pthread_cond_wait (&tenant->executor_cond, &tenant->executor_mutex);
+            if (status != 0)
+                err_abort (status, "Wait for executor work");
+        }
+
+        //Take the queue, leaving the last one's array in its place
+        spare = work;
+        spare_size = work_size;
+        work = tenant->expiries;
+        work_size = tenant->expiry_size;
+        work_count = tenant->expiry_count;
+        tenant->expiries = spare;
+        tenant->expiry_size = spare_size;
+        tenant->expiry_count = 0;
+        status = engine_unlock (&tenant->executor_mutex);
+        if (status != 0)
+            err_abort (status, "Unlock executor mutex");
+
+        for (size_t i = 0; i < work_count; i++) {
+            alarm_t *alarm = work[i].alarm;
+
+            if (work[i].kind == EXPIRY_EXPIRE) {
+                batch_typed(&batch, alarm->type, "Alarm(%d): Alarm Expired at %ld: Alarm Removed From Alarm List\n", alarm->alarm_ID, work[i].when);
+                shm_notify(alarm, ALARM_SHM_EXPIRED);
+            } else if (alarm_live(alarm)) {
+                //Not if it was cancelled or expired while queued
+                assign_alarm_to_display_thread(alarm, &batch);
+            }
+            alarm_release(alarm);
+        }
+        batch_emit(&batch);
+    }
+}
+
+/*
+ * Bounded passes (-U records). The alarm thread works through the hot
+ * array a quantum of at most this many records at a time (rounded up
+ * to a whole DEADLINE_SCAN_MAX block), and lets go of alarm_mutex
+ * between quanta, so however many alarms are pending, the main
+ * thread never waits longer than one quantum to get at the list.
+ * 0 does each pass in one go.
+ */
+int alarm_quantum = 1024;
+
+/*
+ * Let go of alarm_mutex between two quanta of a pass: drop the
+ * references the quantum gave up, and take the mutex back.
+ */
+static void alarm_quantum_break (tenant_t *tenant, alarm_t **expired, int *expired_count) {
+    int status;
+
+    status = engine_unlock (&tenant->alarm_mutex);
+    if (status != 0)
+        err_abort (status, "Unlock mutex");
+    for (int i = 0; i < *expired_count; i++)
+        alarm_release(expired[i]);
+    *expired_count = 0;
+    status = engine_lock (&tenant->alarm_mutex);
+    if (status != 0)
+        err_abort (status, "Lock mutex");
+}
+
+/*
+ * The alarm thread's start routine.
+ */
+void *alarm_thread (void *arg)
+{
+    tenant_t *tenant = (tenant_t *)arg;
+    alarm_t *alarm, *cancelled;
+    alarm_t *expired_alarms[50];
+    int expired_count = 0;
+    int expired_pass, backlog;
+    size_t kept, marked;
+    uint32_t tick;
+    time_t now;
+    int status;
+
+    /*
+     * Loop forever, processing commands. The alarm thread will
+     * be disintegrated when the process exits.
+     */
+    while (1) { 
+        // Lock the mutex to safely modify shared data structures
+        status = engine_lock (&tenant->alarm_mutex);
+        if (status != 0)
+            err_abort (status, "Lock mutex");
+        
+        //Initialize values before traversing
+        now = clock_now();
+        tick = now < tenant->hot_epoch ? 0 : (uint32_t)(now - tenant->hot_epoch);
+        expired_count = 0;
+        expired_pass = 0;
+        backlog = 0;
+
+        //Mark the hot records of alarms cancelled since the last pass, a quantum at a time
+        status = engine_lock (&tenant->index_mutex);
+        if (status != 0)
+            err_abort (status, "Lock index mutex");
+        cancelled = tenant->cancelled;
+        tenant->cancelled = NULL;
+        status = engine_unlock (&tenant->index_mutex);
+        if (status != 0)
+            err_abort (status, "Unlock index mutex");
+        tenant->scanning = 1;
+        cold_page_in(tenant, now, expired_alarms, &expired_count);
+        marked = 0;
+        for (alarm = cancelled; alarm != NULL; alarm = alarm->index_link){
+            if (alarm_quantum > 0 && marked++ == (size_t)alarm_quantum){
+                alarm_quantum_break(tenant, expired_alarms, &expired_count);
+                marked = 1;
+            }
+            hot_t *hot = hot_find(alarm);
+            hot->flags |= HOT_CANCELLED;
+            tenant->hot_keys[hot - tenant->hot] = 0;
+        }
+
+        /*
+         * Traverse the hot records a block at a time, closing up the
+         * gaps left by the ones dropped. Only records whose key is
+         * due are looked at; the others are kept (moved down in bulk
+         * once there is a gap) without being read. Between quanta
+         * (-U) the mutex is let go, with the gap still open.
+         */
+        kept = 0;
+        for (size_t base = 0, quantum = 0; base < tenant->hot_count; base += DEADLINE_SCAN_MAX){
+            if (alarm_quantum > 0 && base - quantum >= (size_t)alarm_quantum){
+                alarm_quantum_break(tenant, expired_alarms, &expired_count);
+                quantum = base;
+            }
+            int block = tenant->hot_count - base < DEADLINE_SCAN_MAX ? (int)(tenant->hot_count - base) : DEADLINE_SCAN_MAX;
+            uint64_t due = deadline_scan(&tenant->hot_keys[base], block, tick);
+
+            if(due == 0){
+                if(kept != base){
+                    memmove(&tenant->hot[kept], &tenant->hot[base], block * sizeof(hot_t));
+                    memmove(&tenant->hot_keys[kept], &tenant->hot_keys[base], block * sizeof(uint32_t));
+                }
+                kept += block;
+                continue;
+            }
+            for (int k = 0; k < block; k++){
+                size_t i = base + k;
+                hot_t *hot = &tenant->hot[i];
+                alarm_t *current = hot->body;
+                int state;
+
+                if(!(due >> k & 1)){
+                    //Not due: keep it
+                } else if(hot->flags & HOT_CANCELLED){
+                    //Cancelled alarm - the cancel already took it out of the index; drop it from the list
+                    repl_log(REPL_CANCEL, current);
+                    tenant->stats_cancelled++;
+                    if(expired_count < 50){
+                        expired_alarms[expired_count++] = current;
+                    }else{
+                        alarm_release(current);
+                    }
+                    continue;
+                } else if(hot->deadline <= tick && catchup_limit > 0 && expired_pass >= catchup_limit){
+                    //This pass has expired its share (-K): keep the rest of the overdue alarms for the next
+                    backlog = 1;
+                } else if(hot->deadline <= tick && (state = atomic_load(&current->state)) != ALARM_CANCELLED
+                        && atomic_compare_exchange_strong(&current->state, &state, ALARM_FIRING)){
+                    //Expired alarm - remove it from the list; the executor prints it, with the hot record's reference
+                    repl_log(REPL_EXPIRE, current);
+                    tenant->stats_expired++;
+                    tenant->pending--;
+                    expired_pass++;
+                    index_remove(current);
+                    alarm_release(current);         //The index's reference
+                    expiry_queue(tenant, current, EXPIRY_EXPIRE, now);
+                    continue;
+                } else if(!(hot->flags & HOT_ASSIGNED)){
+                    //Assign only active, unassigned alarm to the display thread, by way of the executor
+                    state = ALARM_PENDING;
+                    if(atomic_compare_exchange_strong(&current->state, &state, ALARM_ASSIGNED)){
+                        atomic_fetch_add(&current->refs, 1);
+                        expiry_queue(tenant, current, EXPIRY_ASSIGN, now);
+                    }
+                    hot->flags |= HOT_ASSIGNED;
+                    tenant->hot_keys[i] = hot->deadline;
+                }
+                //A due alarm that lost the race with a cancel is dropped next pass, when its cancel is seen
+                if(kept != i){
+                    tenant->hot[kept] = *hot;
+                    tenant->hot_keys[kept] = tenant->hot_keys[i];
+                }
+                kept++;
+            }
+        }
+        tenant->hot_count = kept;
+
+        //The pass is over: add the alarms started during it, and let the readers of the list in
+        hot_merge(tenant, expired_alarms, &expired_count);
+        tenant->scanning = 0;
+        status = pthread_cond_broadcast (&tenant->scan_cond);
+        if (status != 0)
+            err_abort (status, "Signal alarm pass");
+
+        /*
+         * Unlock the mutex before waiting, so that the main
+         * thread can lock it to insert a new alarm request. If
+         * the sleep_time is 0, then call sched_yield, giving
+         * the main thread a chance to run if it has been
+         * readied by user input, without delaying the message
+         * if there's no input.
+         */
+        status = engine_unlock (&tenant->alarm_mutex);
+        if (status != 0)
+            err_abort (status, "Unlock mutex");
+        
+        // Process expired alarms outside of the mutex lock
+        for (int i = 0; i < expired_count; i++) {
+            alarm_t *expired_alarm = expired_alarms[i];
+            
+            // Release the hot record's reference; the alarm is freed once its display lets go too
+            alarm_release(expired_alarm);
+        }
+
+        //Sleep briefly before re-checking the alarm list, or just let others in if overdue alarms are left
+        clock_sleep(backlog ? 0 : 1);
+    }
+}
+
+/*
+ * Start a tenant's alarm thread. Called with tenant_mutex held.
+ */
+static void tenant_start (tenant_t *tenant) {
+    int status;
+
+    clock_thread_start();
+    status = pthread_create(&tenant->thread, NULL, alarm_thread, tenant);
+    if (status != 0) {err_abort(status, "Create alarm thread");}
+    status = pthread_create(&tenant->executor, NULL, executor_thread, tenant);
+    if (status != 0) {err_abort(status, "Create executor thread");}
+    if (rebalance_interval > 0) {
+        pthread_t thread;
+
+        clock_thread_start();
+        status = pthread_create(&thread, NULL, rebalance_thread, tenant);
+        if (status != 0) {err_abort(status, "Create rebalance thread");}
+    }
+    tenant->running = 1;
+}
+
+/*
+ * Find a tenant by name, creating it (and starting its alarm thread,
+ * once the engine is running) if create is set. Returns NULL if
+ * there is no such tenant, or no room for another.
+ *
+ * Lookups take no lock: a tenant is filled in before tenant_count
+ * is raised to include it, and is never removed.
+ */
+tenant_t *tenant_find (const char *name, int create) {
+    tenant_t *tenant = NULL;
+    int count, status;
+
+    count = atomic_load(&tenant_count);
+    for (int i = 0; i < count; i++)
+        if (strcmp(tenants[i]->name, name) == 0)
+            return tenants[i];
+    if (!create)
+        return NULL;
+
+    status = engine_lock(&tenant_mutex);
+    if (status != 0) {err_abort(status, "Lock tenant mutex");}
+    count = atomic_load(&tenant_count);
+    for (int i = 0; i < count && tenant == NULL; i++)
+        if (strcmp(tenants[i]->name, name) == 0)
+            tenant = tenants[i];
+    if (tenant == NULL && count < MAX_TENANTS) {
+        tenant = (tenant_t *)calloc(1, sizeof(tenant_t));
+        if (tenant == NULL) {errno_abort("Allocate tenant");}
+        strncpy(tenant->name, name, sizeof(tenant->name) - 1);
+        pthread_mutex_init(&tenant->alarm_mutex, NULL);
+        pthread_mutex_init(&tenant->display_mutex, NULL);
+        pthread_cond_init(&tenant->display_ready, NULL);
+        pthread_mutex_init(&tenant->index_mutex, NULL);
+        pthread_cond_init(&tenant->scan_cond, NULL);
+        pthread_mutex_init(&tenant->executor_mutex, NULL);
+        pthread_cond_init(&tenant->executor_cond, NULL);
+        tenant->handle_free = HANDLE_NONE;
+        tenant->hot_epoch = clock_now();
+        if (tenants_started)
+            tenant_start(tenant);
+        tenants[count] = tenant;
+        atomic_store(&tenant_count, count + 1);
+    }
+    status = engine_unlock(&tenant_mutex);
+    if (status != 0) {err_abort(status, "Unlock tenant mutex");}
+    return tenant;
+}
+
+/*
+ * Start the alarm threads of the tenants that exist so far (a
+ * follower's, restored from the primary), and of every tenant
+ * created from now on.
+ */
+void tenant_start_all (void) {
+    int status;
+
+    status = engine_lock(&tenant_mutex);
+    if (status != 0) {err_abort(status, "Lock tenant mutex");}
+    tenants_started = 1;
+    for (int i = 0; i < atomic_load(&tenant_count); i++)
+        if (!tenants[i]->running)
+            tenant_start(tenants[i]);
+    status = engine_unlock(&tenant_mutex);
+    if (status != 0) {err_abort(status, "Unlock tenant mutex");}
+}
+
+/*
+ * Commands accepted by the engine. The main thread parses them from
+ * text; other front ends (such as the shared memory ring) build them
+ * directly. Either way they are carried out by apply_command().
+ */
+typedef enum {
+    COMMAND_START,
+    COMMAND_CHANGE,
+    COMMAND_CANCEL,
+    COMMAND_VIEW,
+    COMMAND_STATS
+} command_op_t;
+
+typedef struct command_tag {
+    command_op_t        op;
+    int                 alarm_ID;
+    uint64_t            handle;         //Change/Cancel by handle ("#hex") rather than ID, or 0
+    char                type[3];
+    int                 seconds;
+    char                message[128];
+    int                 client;         //Shared memory client slot, or -1
+    tenant_t            *tenant;        //From the "name:" prefix, or the default tenant
+} command_t;
+
+/*
+ * Find (or create) the tenant a command names. Only called once the
+ * rest of the line has been found valid, so that a mistyped line
+ * never starts a tenant of its own.
+ */
+static int parse_tenant (const char *tenant_name, command_t *cmd) {
+    cmd->tenant = tenant_find(tenant_name, 1);
+    if (cmd->tenant == NULL) {
+        output_error("ERROR: No room for tenant %s (at most %d)\n", tenant_name, MAX_TENANTS);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Parse one input line into a command. Returns 0 on success, or -1
+ * (after printing an error) if the line is not a valid command.
+ */
+int parse_command (char *line, command_t *cmd) {
+    // Variables used in command parsing (Arthi S)
+    char command[16];
+
+    /* Truncate message if it exceeds 128 characters (Arthi S)
+     * Ensures no overflow in error messages, truncates if necessary, 
+     * and warns user if message was truncated.
+     */
+    if (strlen(line) > 128){
+        line[127] = '\0';
+        output_error("WARNING: Message trunated to 128 characters.\n");
+    }
+
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->client = -1;
+
+    //An optional tenant prefix, "name:Command"
+    char tenant_name[16] = "default";
+    size_t span = strspn(line, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_-");
+    if (span > 0 && line[span] == ':') {
+        if (span >= sizeof(tenant_name)) {
+            output_error("ERROR: Tenant name too long in %s", line);
+            return -1;
+        }
+        memcpy(tenant_name, line, span);
+        tenant_name[span] = '\0';
+        line += span + 1;
+    }
+
+    /* Parse and validate command input (Arthi S)
+     * Extracts the command, alarm ID, type, time, and message by parsing the command.
+     * Ensures the proper formatting and validity of commands.
+     */
+    if (strcmp(line, "View_Alarms\n") == 0 || strcmp(line, "View_Alarms") == 0) {
+        cmd->op = COMMAND_VIEW;
+        return parse_tenant(tenant_name, cmd);
+    }
+    if (strcmp(line, "Stats\n") == 0 || strcmp(line, "Stats") == 0) {
+        cmd->op = COMMAND_STATS;
+        return parse_tenant(tenant_name, cmd);
+    }
+    int fields;
+    unsigned long long handle;
+    if (strstr(line, "(#") != NULL) {
+        //Change_Alarm(#handle) and Cancel_Alarm(#handle) name the alarm by its handle
+        fields = sscanf (line, "%15[^(](#%llx): %2s %d %127[^\n]", command, &handle, cmd->type, &cmd->seconds, cmd->message);
+        cmd->handle = handle;
+        if (fields >= 2 && (handle == 0 || strcmp(command, "Start_Alarm") == 0))
+            fields = 0;
+    } else if (dense_ids && strstr(line, "():") != NULL) {
+        //With engine-assigned IDs, Start_Alarm has none: "Start_Alarm(): T1 30 message"
+        fields = sscanf (line, "%15[^(](): %2s %d %127[^\n]", command, cmd->type, &cmd->seconds, cmd->message);
+        fields = fields >= 1 && strcmp(command, "Start_Alarm") == 0 ? fields + 1 : 0;
+    } else {
+        fields = sscanf (line, "%15[^(](%d): %2s %d %127[^\n]", command, &cmd->alarm_ID, cmd->type, &cmd->seconds, cmd->message);
+        if (fields >= 2 && dense_ids && strcmp(command, "Start_Alarm") == 0) {
+            output_error("ERROR: Alarm IDs are assigned by the engine; use Start_Alarm(): %s", line);
+            return -1;
+        }
+    }
+    if (fields < 2) {
+        output_error("ERROR: Invalid command %s", line);
+        return -1;
+    }
+    if (strcmp(command, "Start_Alarm") == 0 && fields >= 4) {
+        cmd->op = COMMAND_START;
+    } else if (strcmp(command, "Change_Alarm") == 0 && fields >= 4) {
+        cmd->op = COMMAND_CHANGE;
+    } else if (strcmp(command, "Cancel_Alarm") == 0) {
+        cmd->op = COMMAND_CANCEL;
+    } else {
+        output_error("ERROR: Invalid command %s\n", command);
+        return -1;
+    }
+    return parse_tenant(tenant_name, cmd);
+}
+
+/*
+ * Wait for the alarm thread to finish its pass, so that the hot array
+ * can be read. Called with the tenant's alarm_mutex held.
+ */
+static void scan_wait (tenant_t *tenant) {
+    int status;
+
+    while (tenant->scanning) {
+        status = pthread_cond_wait(&tenant->scan_cond, &tenant->alarm_mutex);
+        if (status != 0) {err_abort(status, "Wait for alarm pass");}
+    }
+}
+
+/*
+ * Make room in the hot array for count records.
+ */
+static void hot_reserve (tenant_t *tenant, size_t count) {
+    if (count <= tenant->hot_size)
+        return;
+    while (tenant->hot_size < count)
+        tenant->hot_size = tenant->hot_size ? tenant->hot_size * 2 : 1024;
+    tenant->hot = (hot_t *)realloc(tenant->hot, tenant->hot_size * sizeof(hot_t));
+    tenant->hot_keys = (uint32_t *)realloc(tenant->hot_keys, tenant->hot_size * sizeof(uint32_t));
+    if (tenant->hot == NULL || tenant->hot_keys == NULL) {errno_abort("Allocate alarm list");}
+}
+
+/*
+ * Fill in hot record i for an alarm.
+ */
+static void hot_fill (tenant_t *tenant, size_t i, alarm_t *alarm) {
+    tenant->hot[i].deadline = alarm->time < tenant->hot_epoch ? 0 : (uint32_t)(alarm->time - tenant->hot_epoch);
+    tenant->hot[i].alarm_ID = alarm->alarm_ID;
+    tenant->hot[i].type = (uint16_t)((unsigned char)alarm->type[0] << 8 | (unsigned char)alarm->type[1]);
+    tenant->hot[i].flags = 0;
+    tenant->hot[i].body = alarm;
+    tenant->hot_keys[i] = 0;            //The alarm thread assigns it on its next pass
+}
+
+/*
+ * Insert an alarm into its tenant's alarm list, the hot array, which
+ * is kept sorted by alarm ID, or into incoming if the alarm thread is
+ * part way through a pass. Called with the tenant's alarm_mutex held.
+ */
+void insert_alarm (alarm_t *alarm) {
+    tenant_t *tenant = alarm->tenant;
+    size_t i;
+
+    if (tenant->scanning) {
+        if (tenant->incoming_count == tenant->incoming_size) {
+            tenant->incoming_size = tenant->incoming_size ? tenant->incoming_size * 2 : 64;
+            tenant->incoming = (alarm_t **)realloc(tenant->incoming, tenant->incoming_size * sizeof(alarm_t *));
+            if (tenant->incoming == NULL) {errno_abort("Allocate incoming alarms");}
+        }
+        tenant->incoming[tenant->incoming_count++] = alarm;
+        return;
+    }
+    hot_reserve(tenant, tenant->hot_count + 1);
+
+    //IDs mostly arrive in increasing order (always, with -D): append without searching
+    i = tenant->hot_count;
+    if (i > 0 && tenant->hot[i - 1].alarm_ID >= alarm->alarm_ID){
+        i = hot_search(tenant, alarm->alarm_ID);
+        memmove(&tenant->hot[i + 1], &tenant->hot[i], (tenant->hot_count - i) * sizeof(hot_t));
+        memmove(&tenant->hot_keys[i + 1], &tenant->hot_keys[i], (tenant->hot_count - i) * sizeof(uint32_t));
+    }
+    hot_fill(tenant, i, alarm);
+    tenant->hot_count++;
+}
+
+static int incoming_compare (const void *a, const void *b) {
+    int first = (*(alarm_t * const *)a)->alarm_ID, second = (*(alarm_t * const *)b)->alarm_ID;
+
+    return first < second ? -1 : first > second;
+}
+
+/*
+ * Add the alarms started during a pass to the hot array. They are
+ * sorted by ID, then merged in from the back in one pass over the
+ * array, rather than moving its tail once for each alarm that
+ * arrived out of order. An incoming alarm goes before any hot
+ * record with the same ID, as insert_alarm would put it. Called by
+ * the alarm thread with the tenant's alarm_mutex held, while
+ * scanning is still set.
+ *
+ * Like the scan, the merge lets go of the mutex between quanta
+ * (-U), with a gap still open in the array, and sorts in the first
+ * break. Alarms started meanwhile go to incoming again, and are
+ * merged afterwards in one go: there are only as many of them as
+ * got in during the breaks, but the records they displace are not
+ * bounded.
+ */
+static void hot_merge (tenant_t *tenant, alarm_t **expired, int *expired_count) {
+    size_t moved = 0;
+    int status;
+
+    for (int first = 1; tenant->incoming_count > 0; first = 0) {
+        alarm_t **merging = tenant->incoming;
+        size_t count = tenant->incoming_count, size = tenant->incoming_size;
+        int breaks = first && alarm_quantum > 0;
+
+        //Alarms started from here on go to the spare array
+        tenant->incoming = tenant->merging;
+        tenant->incoming_size = tenant->merging_size;
+        tenant->incoming_count = 0;
+        tenant->merging = merging;
+        tenant->merging_size = size;
+
+        hot_reserve(tenant, tenant->hot_count + count);
+        if (breaks) {
+            status = engine_unlock (&tenant->alarm_mutex);
+            if (status != 0)
+                err_abort (status, "Unlock mutex");
+            qsort(merging, count, sizeof(alarm_t *), incoming_compare);
+            status = engine_lock (&tenant->alarm_mutex);
+            if (status != 0)
+                err_abort (status, "Lock mutex");
+        } else
+            qsort(merging, count, sizeof(alarm_t *), incoming_compare);
+
+        size_t i = tenant->hot_count, j = count, at = tenant->hot_count + count;
+        while (j > 0) {
+            if (breaks && moved++ == (size_t)alarm_quantum) {
+                alarm_quantum_break(tenant, expired, expired_count);
+                moved = 1;
+            }
+            if (i > 0 && tenant->hot[i - 1].alarm_ID >= merging[j - 1]->alarm_ID) {
+                i--;
+                at--;
+                tenant->hot[at] = tenant->hot[i];
+                tenant->hot_keys[at] = tenant->hot_keys[i];
+            } else {
+                j--;
+                at--;
+                hot_fill(tenant, at, merging[j]);
+            }
+        }
+        tenant->hot_count += count;
+    }
+}
+
+/*
+ * Start_Alarm command handling
+ * Allocates memory for new alarm, sets time & message,
+ * and inserts it into the sorted list
+ */
+int start_alarm (command_t *cmd) {
+    tenant_t *tenant = cmd->tenant;
+    alarm_t *alarm;
+    int status;
+
+    alarm = alarm_create(tenant);
+    
+    alarm -> seconds = cmd->seconds;
+    strncpy(alarm -> message, cmd->message, sizeof(alarm -> message) - 1);
+    alarm -> message[127] = '\0';   // Ensures null termination
+    alarm -> time = clock_now() + alarm -> seconds;
+    strncpy(alarm->type, cmd->type, sizeof(alarm->type) - 1);
+    alarm->type[2] = '\0';
+    if (dense_ids)
+        cmd->alarm_ID = dense_allocate();
+    alarm->alarm_ID = cmd->alarm_ID;
+    alarm->client = cmd->client;
+
+    /* Locks mutex for thread safe insertion
+    * Lock ensures that only one thread can modify the alarm list
+    * at any given time (prevents race conditions during insertion)
+    */
+    status = engine_lock(&tenant->alarm_mutex);
+    if (status != 0) {err_abort(status, "Lock mutex");}
+
+    //Hold the tenant to its quota of pending alarms (starts are serialized by alarm_mutex)
+    if (quota_pending > 0 && tenant->pending >= quota_pending) {
+        tenant->stats_rejected++;
+        status = engine_unlock(&tenant->alarm_mutex);
+        if (status != 0) {err_abort(status, "Unlock mutex");}
+        output_error("ERROR: Tenant %s already has %d pending alarms; Alarm(%d) not started.\n", tenant->name, quota_pending, alarm->alarm_ID);
+        free(alarm);
+        return -3;
+    }
+    tenant->pending++;
+    if (cold_spill(alarm)) {
+        //Due beyond the horizon: the cold tier has its own copy
+        repl_log(REPL_START, alarm);
+        tenant->stats_started++;
+        status = engine_unlock(&tenant->alarm_mutex);
+        if (status != 0) {err_abort(status, "Unlock mutex");}
+        output_typed(cmd->type, "Alarm(%d) Inserted by Main Thread (%lu) Into Cold Storage at %ld: %s %d %s\n", cmd->alarm_ID, pthread_self(), clock_now(), cmd->type, cmd->seconds, cmd->message);
+        cmd->handle = 0;
+        free(alarm);
+        return 0;
+    }
+    insert_alarm(alarm);
+    index_insert(alarm);
+    cmd->handle = alarm->handle;        //The alarm may be gone once the mutex is let go
+    repl_log(REPL_START, alarm);
+    tenant->stats_started++;
+
+    // Unlock mutex post-insert so other threads can access/modify the alarm list
+    status = engine_unlock(&tenant->alarm_mutex);
+    if (status != 0) {err_abort(status, "Unlock mutex");}
+    output_typed(cmd->type, "Alarm(%d) Inserted by Main Thread (%lu) Into Alarm List at %ld: %s %d %s\n", cmd->alarm_ID, pthread_self(), clock_now(), cmd->type, cmd->seconds, cmd->message);
+    if (show_handles)
+        output_typed(cmd->type, "Alarm(%d) Handle #%016llx\n", cmd->alarm_ID, (unsigned long long)cmd->handle);
+    return 0;
+}
+
+/*
+ * Change_Alarm command handling
+ * Locks the mutex, finds + updates alarm using specified ID,
+ * and unlocks after modification
+ */
+int change_alarm (command_t *cmd) {
+    tenant_t *tenant = cmd->tenant;
+    cold_record_t found;
+    alarm_t *alarm, cold;
+    out_batch_t batch;
+    int status;
+
+    batch_init(&batch);
+    status = engine_lock (&tenant->alarm_mutex);
+    if (status != 0) {err_abort (status, "Lock mutex");}
+    
+    //By handle or engine-assigned ID one array index, otherwise a probe of the ID index (never the hot array, which may be mid-pass)
+    status = engine_lock(&tenant->index_mutex);
+    if (status != 0) {err_abort(status, "Lock index mutex");}
+    alarm = cmd->handle != 0 ? handle_lookup(tenant, cmd->handle)
+        : dense_ids ? dense_lookup(tenant, cmd->alarm_ID) : index_find(tenant, cmd->alarm_ID);
+    status = engine_unlock(&tenant->index_mutex);
+    if (status != 0) {err_abort(status, "Unlock index mutex");}
+    if (alarm != NULL && !alarm_live(alarm))
+        alarm = NULL;
+
+    if (alarm != NULL){
+        alarm -> seconds = cmd->seconds;
+        strncpy(alarm -> message, cmd->message, sizeof(alarm -> message) - 1);
+        atomic_fetch_add(&alarm->revision, 1);      //Displays re-render their line for it
+        batch_typed(&batch, alarm->type, "Alarm(%d) Changed at %ld: %s %d %s\n", alarm->alarm_ID, clock_now(), cmd->type, cmd->seconds, cmd->message);
+        repl_log(REPL_CHANGE, alarm);
+        tenant->stats_changed++;
+    } else if (cmd->handle == 0 && cold_ops != NULL
+            && cold_ops->change(tenant, cmd->alarm_ID, cmd->seconds, cmd->message, &found) == 0) {
+        cold_alarm(tenant, &found, &cold);
+        batch_typed(&batch, cold.type, "Alarm(%d) Changed in Cold Storage at %ld: %s %d %s\n", cmd->alarm_ID, clock_now(), cmd->type, cmd->seconds, cmd->message);
+        repl_log(REPL_CHANGE, &cold);
+        tenant->stats_changed++;
+        alarm = &cold;              //Found, for the result below
+    } else if (cmd->handle != 0) {
+        batch_error(&batch, "ERROR: Alarm handle #%016llx not found for modification.\n", (unsigned long long)cmd->handle);
+    } else {
+        batch_error(&batch, "ERROR: Alarm ID %d not found for modification.\n", cmd->alarm_ID);
+    }
+    status = engine_unlock(&tenant->alarm_mutex);
+    if (status != 0) {err_abort(status, "Unlock mutex");}
+    batch_emit(&batch);
+    return alarm == NULL ? -1 : 0;
+}
+
+/*
+ * Find a cancellable alarm through the ID index and mark it
+ * cancelled with a compare-and-swap. Returns the alarm, still
+ * holding the index's reference, or NULL.
+ */
+static alarm_t *cancel_indexed (tenant_t *tenant, command_t *cmd) {
+    alarm_t *alarm;
+    int status, state;
+
+    status = engine_lock(&tenant->index_mutex);
+    if(status != 0) {err_abort(status, "Lock index mutex");}
+
+    //By handle or engine-assigned ID the lookup is one array index; otherwise a probe of the ID index
+    alarm = cmd->handle != 0 ? handle_lookup(tenant, cmd->handle)
+        : dense_ids ? dense_lookup(tenant, cmd->alarm_ID)
+        : tenant->index_size ? tenant->index_buckets[index_hash(tenant, cmd->alarm_ID)] : NULL;
+    while (alarm != NULL){
+        if (cmd->handle != 0 || alarm->alarm_ID == cmd->alarm_ID){
+            state = atomic_load(&alarm->state);
+            if ((state == ALARM_PENDING || state == ALARM_ASSIGNED)
+                    && atomic_compare_exchange_strong(&alarm->state, &state, ALARM_CANCELLED)){
+                //Out of the index, and queued for the alarm thread to drop its hot record
+                index_unlink(alarm);
+                alarm->index_link = tenant->cancelled;
+                tenant->cancelled = alarm;
+                break;
+            }
+        }
+        alarm = cmd->handle != 0 ? NULL : alarm->index_link;
+    }
+
+    status = engine_unlock(&tenant->index_mutex);
+    if (status != 0) {err_abort(status, "Unlock index mutex");}
+    return alarm;
+}
+
+/*
+ * Cancel_Alarm command handling
+ * Finds the alarm through the ID index and marks it cancelled with
+ * a compare-and-swap, taking neither alarm_mutex nor display_mutex;
+ * the alarm thread drops its hot record and its display stops
+ * printing it on their next pass. Only an alarm that is not in
+ * memory costs alarm_mutex, to look in the cold tier.
+ */
+int cancel_alarm (command_t *cmd) {
+    tenant_t *tenant = cmd->tenant;
+    cold_record_t found;
+    alarm_t *alarm, cold;
+    int status;
+
+    alarm = cancel_indexed(tenant, cmd);
+    if (alarm == NULL && cmd->handle == 0 && cold_ops != NULL){
+        status = engine_lock(&tenant->alarm_mutex);
+        if(status != 0) {err_abort(status, "Lock mutex");}
+        if (cold_ops->cancel(tenant, cmd->alarm_ID, &found) == 0){
+            cold_alarm(tenant, &found, &cold);
+            tenant->cold_count--;
+            tenant->pending--;
+            tenant->stats_cancelled++;
+            repl_log(REPL_CANCEL, &cold);
+            status = engine_unlock(&tenant->alarm_mutex);
+            if (status != 0) {err_abort(status, "Unlock mutex");}
+            output_typed(cold.type, "Alarm(%d) Cancelled at %ld: Removed From Cold Storage\n", cmd->alarm_ID, clock_now());
+            shm_notify(&cold, ALARM_SHM_CANCELLED);
+            return 0;
+        }
+        //Paged in since the first look? Page-in holds alarm_mutex, so this look is final
+        alarm = cancel_indexed(tenant, cmd);
+        status = engine_unlock(&tenant->alarm_mutex);
+        if (status != 0) {err_abort(status, "Unlock mutex");}
+    }
+
+    if (alarm == NULL && cmd->handle != 0){
+        output_error("ERROR: Alarm handle #%016llx not found for cancellation.\n", (unsigned long long)cmd->handle);
+        return -1;
+    }
+    if (alarm == NULL){
+        output_error("ERROR: Alarm ID %d not found for cancellation.\n", cmd->alarm_ID);
+        return -1;
+    }
+    tenant->pending--;                  //Frees quota at once, before the alarm thread unlinks it
+    output_typed(alarm->type, "Alarm(%d) Cancelled at %ld: %s %d %s\n", alarm->alarm_ID, clock_now(), alarm->type, alarm->seconds, alarm->message);
+    shm_notify(alarm, ALARM_SHM_CANCELLED);
+    alarm_release(alarm);               //The index's reference
+    return 0;
+}
+
+/*
+ * View_Alarm command handling
+ * Locks mutex, iterates through the display threads to collect all active alarms
+ * (ensures thread-safe access), then unlocks mutex and prints them
+ */
+int view_alarms (tenant_t *tenant) {
+    out_batch_t batch;
+    int status;
+
+    batch_init(&batch);
+    status = engine_lock(&tenant->alarm_mutex);
+    if(status != 0) {err_abort(status, "Lock mutex");}
+    batch_printf(&batch, "View Alarms at %ld:\n", clock_now());
+
+    //If alarm list is empty
+    if (tenant->hot_count == 0) {
+        batch_printf(&batch, "Alarm list is empty.\n");
+
+    //Print if it is not empty
+    } else {
+        //Displaying the alarm
+        status = engine_lock(&tenant->display_mutex);
+        if(status != 0) {err_abort(status, "Lock mutex");}
+        int i = 0;
+        for(unsigned used = tenant->display_used; used != 0; used &= used - 1, i++){
+            display_t *temp_display = tenant->display_threads[ffs(used) - 1];
+            batch_printf(&batch, "%d. Display Thread %lu Assigned:\n", i, temp_display->threadid);
+
+            for(int k = 0; k < DISPLAY_SLOTS; k++){
+                alarm_t *temp_alarm = temp_display->assigned_alarm[k];
+                if(!(temp_display->occupied & 1U << k) || !alarm_live(temp_alarm)) continue;
+                batch_printf(&batch, "\t%d%c. Alarm(%d): %s %d %s\n", i + 1, k + 97, temp_alarm->alarm_ID, temp_alarm->type, temp_alarm->seconds, temp_alarm->message);
+            }
+        }
+        status = engine_unlock(&tenant->display_mutex);
+        if (status != 0) {err_abort(status, "Unlock mutex");}
+    }
+    //In quiet mode, mark the end of the listing for whoever is parsing it
+    if (quiet)
+        batch_printf(&batch, "End View Alarms\n");
+    // Unlock the mutex after reading shared data structures, then print what was read
+    status = engine_unlock(&tenant->alarm_mutex);
+    if (status != 0) {err_abort(status, "Unlock mutex");}
+    batch_emit(&batch);
+    return 0;
+}
+
+/*
+ * Stats command handling
+ * Prints the tenant's counters on a single line, so that a router in
+ * front of several engines can parse and merge them. Pending counts
+ * alarms in the cold tier too; Cold counts only those.
+ */
+int print_stats (tenant_t *tenant) {
+    out_batch_t batch;
+    int status;
+
+    batch_init(&batch);
+    status = engine_lock(&tenant->alarm_mutex);
+    if(status != 0) {err_abort(status, "Lock mutex");}
+    batch_printf(&batch, "Stats at %ld: Pending %ld Displays %d Started %ld Changed %ld Cancelled %ld Expired %ld Rejected %ld Tenant %s Cold %ld Dropped %ld Coalesced %ld\n",
+        clock_now(), (long)atomic_load(&tenant->pending), tenant->display_thread_count, tenant->stats_started, tenant->stats_changed, tenant->stats_cancelled, tenant->stats_expired,
+        tenant->stats_rejected, tenant->name, tenant->cold_count,
+        atomic_load(&tenant->stats_dropped), atomic_load(&tenant->stats_coalesced));
+    status = engine_unlock(&tenant->alarm_mutex);
+    if (status != 0) {err_abort(status, "Unlock mutex");}
+    batch_emit(&batch);
+    return 0;
+}
+
+/*
+ * Carry out one command, whichever front end it came from. Returns
+ * 0 on success, -1 if the command named an unknown alarm, or -3 if
+ * a Start_Alarm would take its tenant over quota.
+ */
+int apply_command (command_t *cmd) {
+    int result;
+
+    switch (cmd->op) {
+    case COMMAND_START:
+        result = start_alarm(cmd);
+        break;
+    case COMMAND_CHANGE:
+        result = change_alarm(cmd);
+        break;
+    case COMMAND_CANCEL:
+        result = cancel_alarm(cmd);
+        break;
+    case COMMAND_STATS:
+        result = print_stats(cmd->tenant);
+        break;
+    default:
+        result = view_alarms(cmd->tenant);
+        break;
+    }
+#ifdef DEBUG
+    tenant_t *tenant = cmd->tenant;
+    out_batch_t batch;
+    int status;
+    alarm_t *next;
+
+    batch_init (&batch);
+    status = engine_lock (&tenant->alarm_mutex);
+    if (status != 0)
+        err_abort (status, "Lock mutex");
+    scan_wait (tenant);
+    batch_printf (&batch, "[list: ");
+    for (size_t i = 0; i < tenant->hot_count; i++) {
+        next = tenant->hot[i].body;
+        batch_printf (&batch, "%ld(%ld)[\"%s\"] ", next->time,
+            next->time - clock_now (), next->message);
+    }
+    batch_printf (&batch, "]\n");
+    // Unlock the mutex after reading shared data structures
+    status = engine_unlock (&tenant->alarm_mutex);
+    if (status != 0)
+        err_abort (status, "Unlock mutex");
+    batch_emit (&batch);
+#endif
+    return result;
+}
+
+/*
+ * The shm thread's start routine: pop submissions from the shared
+ * memory ring and apply them like commands from stdin. A submission
+ * that fails is handed back to its client as REJECTED.
+ */
+void *shm_thread (void *arg) {
+    alarm_shm_record_t record;
+    command_t cmd;
+
+    while (1) {
+        if (alarm_shm_pop_wait(&shm->submit, shm->submit_cells, &record, 1000) != 0)
+            continue;
+
+        memset(&cmd, 0, sizeof(cmd));
+        cmd.tenant = tenant_find("default", 1);
+        cmd.client = record.client >= 0 && record.client < ALARM_SHM_CLIENTS ? record.client : -1;
+        cmd.alarm_ID = record.alarm_ID;
+        cmd.seconds = record.seconds;
+        memcpy(cmd.type, record.type, sizeof(cmd.type) - 1);
+        memcpy(cmd.message, record.message, sizeof(cmd.message) - 1);
+
+        int result = -1;
+        switch (record.op) {
+        case ALARM_SHM_START:   cmd.op = COMMAND_START;  result = 0; break;
+        case ALARM_SHM_CHANGE:  cmd.op = COMMAND_CHANGE; result = 0; break;
+        case ALARM_SHM_CANCEL:  cmd.op = COMMAND_CANCEL; result = 0; break;
+        }
+        if (result == 0)
+            result = apply_command(&cmd);
+
+        if (result != 0 && cmd.client >= 0) {
+            record.request = record.op;
+            record.op = ALARM_SHM_REJECTED;
+            record.time = clock_now();
+            alarm_shm_push(&shm->clients[cmd.client].ring, shm->clients[cmd.client].cells, &record);
+        }
+    }
+}
+
+static void shm_cleanup (void) {
+    shm_unlink(shm_name);
+}
+
+static void shm_signal (int sig) {
+    shm_stop = 1;
+}
+
+/*
+ * Create the shared memory object and start the shm thread.
+ */
+void shm_start (void) {
+    struct sigaction action;
+    pthread_t thread;
+    int status;
+
+    shm = alarm_shm_map(shm_name, 1);
+    if (shm == NULL) {errno_abort("Create shared memory");}
+    atexit(shm_cleanup);
+
+    //No SA_RESTART: a signal ends a blocking read of stdin as well
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = shm_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    status = pthread_create(&thread, NULL, shm_thread, NULL);
+    if (status != 0) {err_abort(status, "Create shm thread");}
+}
+
+/*
+ * Open a stream socket for an address of the form "unix:PATH" or
+ * "tcp:HOST:PORT": listening if listening is set, else connected.
+ * Returns the socket, or -1 (with errno set).
+ */
+int open_endpoint (const char *address, int listening) {
+    int fd = -1;
+
+    if (strncmp(address, "unix:", 5) == 0) {
+        struct sockaddr_un addr;
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, address + 5, sizeof(addr.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            return -1;
+        if (listening) {
+            unlink(addr.sun_path);
+            if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+                close(fd);
+                return -1;
+            }
+        } else if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    if (strncmp(address, "tcp:", 4) == 0) {
+        char host[256];
+        char *port;
+        struct addrinfo hints, *res, *ai;
+        int one = 1;
+
+        strncpy(host, address + 4, sizeof(host) - 1);
+        host[sizeof(host) - 1] = '\0';
+        port = strrchr(host, ':');
+        if (port == NULL) {
+            errno = EINVAL;
+            return -1;
+        }
+        *port++ = '\0';
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = listening ? AI_PASSIVE : 0;
+        if (getaddrinfo(host[0] ? host : NULL, port, &hints, &res) != 0) {
+            errno = EHOSTUNREACH;
+            return -1;
+        }
+        for (ai = res; ai != NULL; ai = ai->ai_next) {
+            fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (fd < 0)
+                continue;
+            if (listening) {
+                setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+                if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, 8) == 0)
+                    break;
+            } else if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+                break;
+            close(fd);
+            fd = -1;
+        }
+        freeaddrinfo(res);
+        return fd;
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+/*
+ * Read or write exactly len bytes. Returns 0, or -1 on error or
+ * end of file.
+ */
+int read_full (int fd, void *buffer, size_t len) {
+    char *p = buffer;
+
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int write_full (int fd, const void *buffer, size_t len) {
+    const char *p = buffer;
+
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * Replication records travel in network byte order, so a follower
+ * on another machine decodes them the same way.
+ */
+static void put_u32 (unsigned char *p, uint32_t v) {
+    p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+static uint32_t get_u32 (const unsigned char *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static void put_u64 (unsigned char *p, uint64_t v) {
+    put_u32(p, v >> 32);
+    put_u32(p + 4, (uint32_t)v);
+}
+
+static uint64_t get_u64 (const unsigned char *p) {
+    return (uint64_t)get_u32(p) << 32 | get_u32(p + 4);
+}
+
+static void repl_encode (unsigned char *p, const repl_record_t *record) {
+    put_u32(p, record->op);
+    put_u32(p + 4, record->alarm_ID);
+    put_u32(p + 8, record->seconds);
+    put_u32(p + 12, 0);
+    put_u64(p + 16, (uint64_t)record->time);
+    memcpy(p + 24, record->type, 3);
+    p[27] = 0;
+    memcpy(p + 28, record->message, 128);
+    memcpy(p + 156, record->tenant, 16);
+    put_u32(p + 172, 0);
+}
+
+static void repl_decode (const unsigned char *p, repl_record_t *record) {
+    record->op = get_u32(p);
+    record->alarm_ID = (int)get_u32(p + 4);
+    record->seconds = (int)get_u32(p + 8);
+    record->time = (time_t)get_u64(p + 16);
+    memcpy(record->type, p + 24, 3);
+    record->type[2] = '\0';
+    memcpy(record->message, p + 28, 128);
+    record->message[127] = '\0';
+    memcpy(record->tenant, p + 156, 16);
+    record->tenant[15] = '\0';
+}
+
+/*
+ * The replication thread's start routine. Serve one follower at a
+ * time: send it a snapshot of the alarm list, then every change since,
+ * in batches of up to REPL_BATCH records. A batch goes out as soon
+ * as it is full, or REPL_FLUSH_MS after its first record arrived.
+ */
+/*
+ * Snapshot a cold alarm for a new follower, which keeps it in memory.
+ */
+static void cold_replicate (tenant_t *tenant, const cold_record_t *record) {
+    alarm_t cold;
+
+    cold_alarm(tenant, record, &cold);
+    repl_log(REPL_START, &cold);
+}
+
+void *repl_thread (void *arg) {
+    int listen_fd = *(int *)arg;
+    static unsigned char frame[16 + REPL_BATCH * REPL_RECORD_SIZE];
+    repl_record_t *batch = NULL;
+    int batch_size = 0;
+    uint64_t sequence = 0;
+    alarm_t *alarm;
+    int status;
+
+    while (1) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            errno_abort("Accept follower");
+        }
+
+        /*
+         * Snapshot every tenant's list and start logging under the
+         * same locks. tenant_mutex keeps the set of tenants still;
+         * a tenant created afterwards starts out empty, and logs
+         * everything that happens to it.
+         */
+        status = engine_lock(&tenant_mutex);
+        if (status != 0) {err_abort(status, "Lock tenant mutex");}
+        int count = atomic_load(&tenant_count);
+        for (int i = 0; i < count; i++) {
+            status = engine_lock(&tenants[i]->alarm_mutex);
+            if (status != 0) {err_abort(status, "Lock mutex");}
+            scan_wait(tenants[i]);
+        }
+        status = engine_lock(&repl_mutex);
+        if (status != 0) {err_abort(status, "Lock replication mutex");}
+        repl_log_count = 0;
+        repl_active = 1;
+        status = engine_unlock(&repl_mutex);
+        if (status != 0) {err_abort(status, "Unlock replication mutex");}
+        for (int i = 0; i < count; i++) {
+            for (size_t k = 0; k < tenants[i]->hot_count; k++) {
+                alarm = tenants[i]->hot[k].body;
+                if (alarm_live(alarm))
+                    repl_log(REPL_START, alarm);
+            }
+            if (cold_ops != NULL && tenants[i]->cold_count > 0)
+                cold_ops->scan(tenants[i], cold_replicate);
+            status = engine_unlock(&tenants[i]->alarm_mutex);
+            if (status != 0) {err_abort(status, "Unlock mutex");}
+        }
+        status = engine_unlock(&tenant_mutex);
+        if (status != 0) {err_abort(status, "Unlock tenant mutex");}
+        output("Follower Connected at %ld\n", clock_now());
+
+        while (1) {
+            status = engine_lock(&repl_mutex);
+            if (status != 0) {err_abort(status, "Lock replication mutex");}
+            while (repl_active && repl_log_count == 0) {
+                status = pthread_cond_wait(&repl_cond, &repl_mutex);
+                if (status != 0) {err_abort(status, "Wait for replication");}
+            }
+            if (repl_active && repl_log_count < REPL_BATCH) {
+                struct timespec deadline;
+
+                clock_gettime(CLOCK_REALTIME, &deadline);
+                deadline.tv_nsec += REPL_FLUSH_MS * 1000000L;
+                if (deadline.tv_nsec >= 1000000000L) {
+                    deadline.tv_sec++;
+                    deadline.tv_nsec -= 1000000000L;
+                }
+                status = pthread_cond_timedwait(&repl_cond, &repl_mutex, &deadline);
+                if (status != 0 && status != ETIMEDOUT) {err_abort(status, "Wait for replication");}
+            }
+            if (!repl_active) {
+                repl_log_count = 0;
+                status = engine_unlock(&repl_mutex);
+                if (status != 0) {err_abort(status, "Unlock replication mutex");}
+                break;
+            }
+
+            //Take the whole log, leaving the spare buffer in its place
+            repl_record_t *records = repl_log_records;
+            int count = repl_log_count, size = repl_log_size;
+            repl_log_records = batch;
+            repl_log_size = batch_size;
+            repl_log_count = 0;
+            batch = records;
+            batch_size = size;
+            status = engine_unlock(&repl_mutex);
+            if (status != 0) {err_abort(status, "Unlock replication mutex");}
+
+            int failed = 0;
+            for (int first = 0; first < count && !failed; first += REPL_BATCH) {
+                int n = count - first < REPL_BATCH ? count - first : REPL_BATCH;
 
-pthread_mutex_t alarm_mutex = PTHREAD_MUTEX_INITIALIZER;    //Mutex for alarm
-pthread_mutex_t display_mutex = PTHREAD_MUTEX_INITIALIZER;  //Mutex for display
-alarm_t *alarm_list = NULL;
+                put_u32(frame, REPL_MAGIC);
+                put_u32(frame + 4, n);
+                put_u64(frame + 8, sequence);
+                for (int i = 0; i < n; i++)
+                    repl_encode(frame + 16 + i * REPL_RECORD_SIZE, &batch[first + i]);
+                failed = write_full(fd, frame, 16 + n * REPL_RECORD_SIZE) != 0;
+                sequence += n;
+            }
+            if (failed) {
+                status = engine_lock(&repl_mutex);
+                if (status != 0) {err_abort(status, "Lock replication mutex");}
+                repl_active = 0;
+                repl_log_count = 0;
+                status = engine_unlock(&repl_mutex);
+                if (status != 0) {err_abort(status, "Unlock replication mutex");}
+                break;
+            }
+        }
+        close(fd);
+        output("Follower Disconnected at %ld\n", clock_now());
+    }
+}
 
-display_t *display_threads[10];                             //Limit display threads to 10 to prevent overload
-int display_thread_count = 0;                               //Number of thread currently in the display array
+/*
+ * Start listening for a follower (-R).
+ */
+void repl_start (void) {
+    static int listen_fd;
+    pthread_t thread;
+    int status;
 
+    listen_fd = open_endpoint(repl_address, 1);
+    if (listen_fd < 0) {errno_abort("Listen for follower");}
+    status = pthread_create(&thread, NULL, repl_thread, &listen_fd);
+    if (status != 0) {err_abort(status, "Create replication thread");}
+}
 
 /*
-* Display Threads
-*/
-void *display_thread (void *arg) {
-   display_t *display_thread = (display_t*) arg;
-   int status;
+ * Follower mode (-F). Mirror the primary's alarm list until the
+ * replication stream ends, then return so that main can take over
+ * with the alarms already in place. Display assignment is not
+ * replicated: the alarm thread reassigns every alarm on takeover.
+ */
+void follow_primary (void) {
+    unsigned char header[16];
+    static unsigned char body[REPL_BATCH * REPL_RECORD_SIZE];
+    repl_record_t record;
+    alarm_t *alarm;
+    size_t at = 0;
+    int fd, status, restored = 0;
 
-   while(1){
-        // Lock the mutex to safely modify shared data structures
-        status = pthread_mutex_lock (&display_mutex);
-        if (status != 0)
-            err_abort (status, "Lock mutex");
-        
-        
-        int active_alarm = 0;
+    //The primary may still be starting: keep trying for a while
+    for (int attempt = 0; (fd = open_endpoint(follow_address, 0)) < 0; attempt++) {
+        if (attempt == 50) {errno_abort("Connect to primary");}
+        usleep(100000);
+    }
+    output("Following Primary %s at %ld\n", follow_address, clock_now());
 
-        // Check each alarm in the display thread
-        for(int i = 0; i < 2; i++){
-            alarm_t *alarm = display_thread->assigned_alarm[i];
-            
-            if(alarm != NULL){     //Alarm exists to analyze
-                time_t now = time(NULL);
+    while (read_full(fd, header, sizeof(header)) == 0) {
+        uint32_t count = get_u32(header + 4);
 
-                //Expired alarm
-                if(now >= alarm->time){
-                    printf("Alarm(%d) Expired; Display Thread (%lu) Stopped Printing Alarm Message at %ld: %s %d %s\n", alarm->alarm_ID, display_thread->threadid, now, alarm->type, alarm->seconds, alarm->message);
-                    display_thread->assigned_alarm[i] = NULL;   //Clear the expired alarm
-                    display_thread->assigned_alarm_count--;
-                
-                //Alarm does not expire and print the periodic message
-                }else {
-                    printf("Alarm(%d) Message PERIODICALLY PRINTED BY Display Thread (%lu) at %ld: %s %d %s\n", alarm->alarm_ID, display_thread->threadid, now, alarm->type, alarm->seconds, alarm->message);
-                    active_alarm++;
-                }
+        if (get_u32(header) != REPL_MAGIC || count > REPL_BATCH
+                || read_full(fd, body, count * REPL_RECORD_SIZE) != 0)
+            break;
+
+        for (uint32_t i = 0; i < count; i++) {
+            repl_decode(body + i * REPL_RECORD_SIZE, &record);
+            tenant_t *tenant = tenant_find(record.tenant, 1);
+            if (tenant == NULL)
+                continue;
+            status = engine_lock(&tenant->alarm_mutex);
+            if (status != 0) {err_abort(status, "Lock mutex");}
+            scan_wait(tenant);
+            if (record.op == REPL_START) {
+                alarm = alarm_create(tenant);
+                alarm->seconds = record.seconds;
+                alarm->time = record.time;
+                memcpy(alarm->type, record.type, sizeof(alarm->type));
+                memcpy(alarm->message, record.message, sizeof(alarm->message));
+                alarm->alarm_ID = record.alarm_ID;
+                insert_alarm(alarm);
+                index_insert(alarm);
+                tenant->pending++;
+                restored++;
+
+                //After takeover, engine-assigned IDs carry on past the primary's
+                if (dense_ids && record.alarm_ID >= atomic_load(&dense_next))
+                    atomic_store(&dense_next, record.alarm_ID + 1);
+            } else {
+                //Find the alarm the record refers to
+                alarm = NULL;
+                for (at = hot_search(tenant, record.alarm_ID); at < tenant->hot_count && tenant->hot[at].alarm_ID == record.alarm_ID; at++)
+                    if (tenant->hot[at].body->time == record.time) {
+                        alarm = tenant->hot[at].body;
+                        break;
+                    }
             }
+            if (record.op == REPL_START || alarm == NULL) {
+                //Nothing more to do
+            } else if (record.op == REPL_CHANGE) {
+                alarm->seconds = record.seconds;
+                memcpy(alarm->message, record.message, sizeof(alarm->message));
+            } else {
+                memmove(&tenant->hot[at], &tenant->hot[at + 1], (tenant->hot_count - at - 1) * sizeof(hot_t));
+                memmove(&tenant->hot_keys[at], &tenant->hot_keys[at + 1], (tenant->hot_count - at - 1) * sizeof(uint32_t));
+                tenant->hot_count--;
+                index_remove(alarm);
+                alarm_release(alarm);
+                alarm_release(alarm);
+                tenant->pending--;
+                restored--;
+            }
+            status = engine_unlock(&tenant->alarm_mutex);
+            if (status != 0) {err_abort(status, "Unlock mutex");}
         }
-        
-        //No alarm in the display thread, terminate the thread
-        if(active_alarm == 0) {
-            printf("Display Thread Terminated (%lu) at %ld\n", display_thread->threadid, time(NULL));
-            status = pthread_mutex_unlock (&display_mutex);
-            if (status != 0)
-                err_abort (status, "Unlock mutex");
-            free(display_thread);
-            display_thread_count--;
-            pthread_exit(NULL);
-        }
-
-        // Unlock the mutex after modifying shared data structures
-        status = pthread_mutex_unlock (&display_mutex);
-        if (status != 0)
-             err_abort (status, "Unlock mutex");
-        
-        //Sleep briefly before re-checking the display thread
-        sleep(5);
-   }
+    }
+    close(fd);
+    output("Follower Took Over at %ld: %d Alarms Restored\n", clock_now(), restored);
 }
 
 /*
-* Create a display thread function
-*/
-display_t *create_display_thread(char *type) {
-    if(display_thread_count >= 10) return NULL;   //Limits the number of threads
+ * Pipelined mode (-P ack_target). The main thread reads and applies
+ * commands back to back, without the prompt or the pause after each
+ * one. A command may carry a client sequence number, "@SEQ Command",
+ * and is then acknowledged out of band on the ack target with a line
+ * "ACK SEQ OK" or "ACK SEQ ERROR reason" once it has been applied.
+ * With -D, the ack for a Start_Alarm also carries the ID the engine
+ * gave the alarm, and with -H its handle: "ACK SEQ OK ID #handle".
+ *
+ * Acknowledgements are queued and written by the ack thread, so a
+ * slow reader of the acks never holds up command processing.
+ */
+typedef struct ack_tag {
+    long                sequence;
+    int                 result;         //0, or -1 not found, -2 invalid, -3 over quota
+    int                 alarm_ID;       //Engine-assigned ID of a started alarm, or 0
+    uint64_t            handle;         //Handle of a started alarm, or 0
+} ack_t;
 
-    // Create new display
-    display_t *new_thread = (display_t*) malloc(sizeof(display_t));
-    if (new_thread == NULL) {
-        fprintf(stderr, "Error: Could not allocate memory for new display thread.\n");
-        return NULL;
-    }
+pthread_mutex_t ack_mutex = PTHREAD_MUTEX_INITIALIZER;      //Protects the ack queue
+pthread_cond_t ack_cond = PTHREAD_COND_INITIALIZER;         //Queue not empty, or drained
+const char *ack_target = NULL;
+int ack_fd = -1;
+ack_t *ack_queue = NULL;
+int ack_count = 0;
+int ack_size = 0;
+int ack_writing = 0;                                        //Ack thread has a batch in hand
 
-    //Set the thread base on alarm type
-    strcpy(new_thread->type, type);
-    new_thread->assigned_alarm_count = 0;
+/*
+ * Queue the acknowledgement for one command.
+ */
+void ack_post (long sequence, int result, command_t *cmd) {
+    int status;
 
-    //Create the thread
-    int status = pthread_create(&new_thread->threadid, NULL, display_thread, new_thread);
-    if(status != 0){
-        free(new_thread);
-        err_abort(status, "Create display Thread");
+    status = engine_lock(&ack_mutex);
+    if (status != 0) {err_abort(status, "Lock ack mutex");}
+    if (ack_count == ack_size) {
+        ack_size = ack_size ? ack_size * 2 : 1024;
+        ack_queue = realloc(ack_queue, ack_size * sizeof(ack_t));
+        if (ack_queue == NULL) {errno_abort("Allocate ack queue");}
     }
+    ack_queue[ack_count].sequence = sequence;
+    ack_queue[ack_count].result = result;
+    ack_queue[ack_count].alarm_ID = dense_ids && result == 0 && cmd->op == COMMAND_START ? cmd->alarm_ID : 0;
+    ack_queue[ack_count].handle = show_handles && result == 0 && cmd->op == COMMAND_START ? cmd->handle : 0;
+    if (ack_count++ == 0) {
+        status = pthread_cond_broadcast(&ack_cond);
+        if (status != 0) {err_abort(status, "Signal ack");}
+    }
+    status = engine_unlock(&ack_mutex);
+    if (status != 0) {err_abort(status, "Unlock ack mutex");}
+}
+
+/*
+ * The ack thread's start routine: take everything queued, format it
+ * into one buffer and write it with a single system call.
+ */
+void *ack_thread (void *arg) {
+    ack_t *batch = NULL;
+    int batch_size = 0;
+    char *text = NULL;
+    size_t text_size = 0;
+    int status;
 
-    //Increase the count of display thread;
-    display_thread_count++;
+    while (1) {
+        status = engine_lock(&ack_mutex);
+        if (status != 0) {err_abort(status, "Lock ack mutex");}
+        ack_writing = 0;
+        while (ack_count == 0) {
+            status = pthread_cond_broadcast(&ack_cond);     //Wake ack_drain()
+            if (status != 0) {err_abort(status, "Signal ack");}
+            status = pthread_cond_wait(&ack_cond, &ack_mutex);
+            if (status != 0) {err_abort(status, "Wait for ack");}
+        }
+        ack_t *taken = ack_queue;
+        int count = ack_count, size = ack_size;
+        ack_queue = batch;
+        ack_size = batch_size;
+        ack_count = 0;
+        batch = taken;
+        batch_size = size;
+        ack_writing = 1;
+        status = engine_unlock(&ack_mutex);
+        if (status != 0) {err_abort(status, "Unlock ack mutex");}
 
-    //Add the thread to the array of threads where empty
-    for(int i = 0; i < display_thread_count; i++){
-        if(display_threads[i] == NULL){
-            display_threads[i] = new_thread;
+        //"ACK " + 20 digits + " ERROR Not_Found\n", or " OK " + ID + " #" + 16 digits, fits in 64 bytes
+        if (text_size < (size_t)count * 64) {
+            text_size = (size_t)count * 64;
+            text = realloc(text, text_size);
+            if (text == NULL) {errno_abort("Allocate ack text");}
+        }
+        size_t len = 0;
+        for (int i = 0; i < count; i++) {
+            len += sprintf(text + len, "ACK %ld %s", batch[i].sequence,
+                batch[i].result == 0 ? "OK" :
+                batch[i].result == -1 ? "ERROR Not_Found" :
+                batch[i].result == -3 ? "ERROR Quota" : "ERROR Invalid");
+            if (batch[i].alarm_ID != 0)
+                len += sprintf(text + len, " %d", batch[i].alarm_ID);
+            if (batch[i].handle != 0)
+                len += sprintf(text + len, " #%016llx", (unsigned long long)batch[i].handle);
+            text[len++] = '\n';
+        }
+        //Once the consumer has gone, acks are discarded: they are a side channel, not worth the engine
+        for (size_t done = 0; done < len && ack_fd >= 0; ) {
+            ssize_t n = write(ack_fd, text + done, len - done);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0) {
+                output_error("ERROR: Writing acks to %s failed (%s); acks discarded from now on\n", ack_target, n < 0 ? strerror(errno) : "no progress");
+                close(ack_fd);
+                ack_fd = -1;
+                break;
+            }
+            done += n;
         }
     }
-    
-    //Return the created thread
-    return new_thread;
 }
 
 /*
-* Assign Alarm to the Right Thread
-*/
-void assign_alarm_to_display_thread(alarm_t *new_alarm) {
-
-    //Initialize variables and pointers
-    int thread_found = 0;
-    int type_found = 0;
-    display_t *target_thread = NULL;
+ * Wait until every queued acknowledgement has been written.
+ */
+void ack_drain (void) {
     int status;
-    alarm_t *temp_alarm = new_alarm;
 
-    // Lock the mutex to safely modify shared data structures
-    status = pthread_mutex_lock(&display_mutex);
-    if (status != 0) {
-        err_abort(status, "Lock mutex");
+    status = engine_lock(&ack_mutex);
+    if (status != 0) {err_abort(status, "Lock ack mutex");}
+    while (ack_count > 0 || ack_writing) {
+        status = pthread_cond_wait(&ack_cond, &ack_mutex);
+        if (status != 0) {err_abort(status, "Wait for ack");}
     }
+    status = engine_unlock(&ack_mutex);
+    if (status != 0) {err_abort(status, "Unlock ack mutex");}
+}
+
+/*
+ * Open the ack target -- "fd:N", "unix:PATH", "tcp:HOST:PORT" or a
+ * file (or fifo) name -- and start the ack thread.
+ */
+void ack_start (void) {
+    pthread_t thread;
+    int status;
+
+    if (strncmp(ack_target, "fd:", 3) == 0)
+        ack_fd = atoi(ack_target + 3);
+    else if (strncmp(ack_target, "unix:", 5) == 0 || strncmp(ack_target, "tcp:", 4) == 0)
+        ack_fd = open_endpoint(ack_target, 0);
+    else
+        ack_fd = open(ack_target, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (ack_fd < 0) {errno_abort("Open ack target");}
+    signal(SIGPIPE, SIG_IGN);
+
+    status = pthread_create(&thread, NULL, ack_thread, NULL);
+    if (status != 0) {err_abort(status, "Create ack thread");}
+}
+
+/*
+ * Staged ingestion (-j workers), for bulk replays. Instead of the
+ * main thread reading, parsing and applying one line at a time:
+ *
+ *   - the reader thread fills large buffers from stdin and cuts each
+ *     one after its last newline, numbering the chunks in order;
+ *   - parser threads take whole chunks and turn every line into a
+ *     command, in parallel;
+ *   - the main thread applies the parsed chunks strictly in chunk
+ *     order, so commands take effect in exactly the order they were
+ *     read, however the parsers raced.
+ *
+ * At most PIPE_WINDOW chunks are in flight at once, which bounds the
+ * memory a fast reader can tie up ahead of a slow apply stage.
+ */
+#define PIPE_CHUNK          (1 << 20)       //Bytes read per chunk
+#define PIPE_WINDOW         64              //Chunks in flight
+
+typedef struct chunk_tag {
+    struct chunk_tag    *link;
+    long                number;         //Position in the input
+    char                *text;
+    size_t              len;
+    command_t           *commands;
+    long                *tags;          //"@SEQ" of each command, or -1
+    int                 *valid;         //Parsed successfully
+    int                 count;
+} chunk_t;
 
-    //Find the target thread for the alarm based on their type and the display capacity
-    for(int i = 0; i < display_thread_count; i++){
-        if(strcmp(display_threads[i]->type, temp_alarm->type) == 0){
-            type_found = 1;
-            if(display_threads[i]->assigned_alarm_count < 2){
-                thread_found = 1;
-                target_thread = display_threads[i];
+pthread_mutex_t pipe_mutex = PTHREAD_MUTEX_INITIALIZER;     //Protects the pipeline state below
+pthread_cond_t pipe_read_cond = PTHREAD_COND_INITIALIZER;   //Reader: a window slot is free
+pthread_cond_t pipe_parse_cond = PTHREAD_COND_INITIALIZER;  //Parsers: a chunk was read
+pthread_cond_t pipe_apply_cond = PTHREAD_COND_INITIALIZER;  //Main: a chunk was parsed
+int pipe_workers = 0;
+chunk_t *pipe_unparsed = NULL, **pipe_unparsed_tail = &pipe_unparsed;
+chunk_t *pipe_parsed[PIPE_WINDOW];      //Parsed chunks, by number % PIPE_WINDOW
+long pipe_next_apply = 0;               //Number of the next chunk to apply
+long pipe_read_total = -1;              //Chunks read in all, once stdin is at EOF
+
+/*
+ * The reader thread's start routine.
+ */
+void *pipe_reader_thread (void *arg) {
+    char *carry = NULL;
+    size_t carry_len = 0;
+    long number = 0;
+    int status;
+
+    while (1) {
+        chunk_t *chunk = (chunk_t *)calloc(1, sizeof(chunk_t));
+        if (chunk == NULL) {errno_abort("Allocate chunk");}
+        chunk->text = (char *)malloc(carry_len + PIPE_CHUNK + 1);
+        if (chunk->text == NULL) {errno_abort("Allocate chunk");}
+        if (carry_len > 0)
+            memcpy(chunk->text, carry, carry_len);
+        chunk->len = carry_len;
+
+        //Fill the buffer, unless input runs out first
+        int at_eof = 0;
+        while (chunk->len < carry_len + PIPE_CHUNK) {
+            ssize_t n = read(STDIN_FILENO, chunk->text + chunk->len, carry_len + PIPE_CHUNK - chunk->len);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0) {
+                at_eof = 1;
                 break;
             }
+            chunk->len += n;
         }
-    }
 
-    //Two cases for creating new thread
-    if(!thread_found && !type_found){
-        target_thread = create_display_thread(temp_alarm->type);
-        printf("First New Display Thread (%lu) Created at %ld: %s %d %s\n", target_thread->threadid, time(NULL), temp_alarm->type, temp_alarm->seconds, temp_alarm->message);
-    }else if(!thread_found && type_found){
-        target_thread = create_display_thread(temp_alarm->type);
-        printf("Additional New Display Thread (%lu) Created at %ld: %s %d %s\n", target_thread->threadid, time(NULL), temp_alarm->type, temp_alarm->seconds, temp_alarm->message);
-    }
-
-    //Assign the alarm to the target thread
-    if(target_thread != NULL){
-        target_thread->assigned_alarm[target_thread->assigned_alarm_count++] = temp_alarm;
-        printf("Alarm (%d) Assigned to Display Thread (%lu) at %ld: %s %d %s\n", temp_alarm->alarm_ID, target_thread->threadid, time(NULL), temp_alarm->type, temp_alarm->seconds, temp_alarm->message); 
-    } else {
-        fprintf(stderr, "Error: Could not create new display thread.\n");
-    }
+        //Cut after the last newline, carrying the partial line over
+        size_t cut = chunk->len;
+        if (!at_eof) {
+            while (cut > 0 && chunk->text[cut - 1] != '\n')
+                cut--;
+            if (cut == 0)
+                cut = chunk->len;       //A line longer than a chunk: cut it anyway
+        }
+        free(carry);
+        carry_len = chunk->len - cut;
+        carry = (char *)malloc(carry_len + 1);
+        if (carry == NULL) {errno_abort("Allocate chunk");}
+        memcpy(carry, chunk->text + cut, carry_len);
+        chunk->len = cut;
+        chunk->text[cut] = '\0';
 
-    // Unlock the mutex after modifying shared data structures
-    status = pthread_mutex_unlock(&display_mutex);
-    if (status != 0) {
-        err_abort(status, "Unlock mutex");
+        status = engine_lock(&pipe_mutex);
+        if (status != 0) {err_abort(status, "Lock pipeline mutex");}
+        while (number - pipe_next_apply >= PIPE_WINDOW) {
+            status = pthread_cond_wait(&pipe_read_cond, &pipe_mutex);
+            if (status != 0) {err_abort(status, "Wait for pipeline");}
+        }
+        chunk->number = number++;
+        *pipe_unparsed_tail = chunk;
+        pipe_unparsed_tail = &chunk->link;
+        if (at_eof)
+            pipe_read_total = number;
+        status = pthread_cond_signal(&pipe_parse_cond);
+        if (status != 0) {err_abort(status, "Signal pipeline");}
+        if (at_eof) {
+            //The apply stage may be waiting for a chunk that will never come
+            status = pthread_cond_signal(&pipe_apply_cond);
+            if (status != 0) {err_abort(status, "Signal pipeline");}
+        }
+        status = engine_unlock(&pipe_mutex);
+        if (status != 0) {err_abort(status, "Unlock pipeline mutex");}
+        if (at_eof)
+            break;
     }
+    free(carry);
+    return NULL;
 }
 
-void cancel_alarm_in_display_thread (alarm_t *target_alarm){
-    //Initialize variable
+/*
+ * The parser threads' start routine.
+ */
+void *pipe_parser_thread (void *arg) {
+    char line[256];
     int status;
 
-    // Lock the mutex to safely modify shared data structures
-    status = pthread_mutex_lock(&display_mutex);
-    if (status != 0) {
-        err_abort(status, "Lock mutex");
-    }
+    while (1) {
+        status = engine_lock(&pipe_mutex);
+        if (status != 0) {err_abort(status, "Lock pipeline mutex");}
+        while (pipe_unparsed == NULL) {
+            status = pthread_cond_wait(&pipe_parse_cond, &pipe_mutex);
+            if (status != 0) {err_abort(status, "Wait for pipeline");}
+        }
+        chunk_t *chunk = pipe_unparsed;
+        pipe_unparsed = chunk->link;
+        if (pipe_unparsed == NULL)
+            pipe_unparsed_tail = &pipe_unparsed;
+        status = engine_unlock(&pipe_mutex);
+        if (status != 0) {err_abort(status, "Unlock pipeline mutex");}
+
+        int lines = 0;
+        for (size_t i = 0; i < chunk->len; i++)
+            lines += chunk->text[i] == '\n';
+        lines++;
+        chunk->commands = (command_t *)malloc(lines * sizeof(command_t));
+        chunk->tags = (long *)malloc(lines * sizeof(long));
+        chunk->valid = (int *)malloc(lines * sizeof(int));
+        if (chunk->commands == NULL || chunk->tags == NULL || chunk->valid == NULL) {
+            errno_abort("Allocate commands");
+        }
 
-    //Find the thread that has the alarm
-    for(int i = 0; i < display_thread_count; i++){
-        display_t *temp_display = display_threads[i];
-        for(int k = 0; k < temp_display->assigned_alarm_count; k++){
+        char *next = chunk->text;
+        while (*next != '\0') {
+            char *end = strchr(next, '\n');
+            size_t len = end != NULL ? (size_t)(end - next) : strlen(next);
+            char *text = line;
 
-            //Check for match alarm
-            if(target_alarm->alarm_ID == temp_display->assigned_alarm[k]->alarm_ID){
-                //Remove this alarm and print the message
-                temp_display->assigned_alarm[k] = NULL;
-                temp_display->assigned_alarm_count--;
+            if (len > sizeof(line) - 2)
+                len = sizeof(line) - 2;
+            memcpy(line, next, len);
+            line[len] = '\n';
+            line[len + 1] = '\0';
+            next = end != NULL ? end + 1 : next + strlen(next);
+            if (len == 0)
+                continue;
 
-                printf("Alarm(%d) Cancelled; Display Thread (%lu) Stopped Printing Alarm Message at %ld: %s %d %s\n", target_alarm->alarm_ID, temp_display->threadid, time(NULL), target_alarm->type, target_alarm->seconds, target_alarm->message);
+            long tag = -1;
+            if (ack_target != NULL && line[0] == '@') {
+                tag = strtol(line + 1, &text, 10);
+                while (*text == ' ')
+                    text++;
             }
+            chunk->tags[chunk->count] = tag;
+            chunk->valid[chunk->count] = parse_command(text, &chunk->commands[chunk->count]) == 0;
+            chunk->count++;
         }
-    }
-    // Unlock the mutex after modifying shared data structures
-    status = pthread_mutex_unlock(&display_mutex);
-    if (status != 0) {
-        err_abort(status, "Unlock mutex");
+        free(chunk->text);
+        chunk->text = NULL;
+
+        status = engine_lock(&pipe_mutex);
+        if (status != 0) {err_abort(status, "Lock pipeline mutex");}
+        pipe_parsed[chunk->number % PIPE_WINDOW] = chunk;
+        if (chunk->number == pipe_next_apply) {
+            status = pthread_cond_signal(&pipe_apply_cond);
+            if (status != 0) {err_abort(status, "Signal pipeline");}
+        }
+        status = engine_unlock(&pipe_mutex);
+        if (status != 0) {err_abort(status, "Unlock pipeline mutex");}
     }
 }
 
 /*
- * The alarm thread's start routine.
+ * The apply stage, run by the main thread until the input is used up.
  */
-void *alarm_thread (void *arg)
-{
-    alarm_t *alarm, *prev, *current;
-    alarm_t *expired_alarms[50];
-    int expired_count = 0;
-    int sleep_time;
-    time_t now;
+void run_pipeline (void) {
+    pthread_t thread;
     int status;
 
-    /*
-     * Loop forever, processing commands. The alarm thread will
-     * be disintegrated when the process exits.
-     */
-    while (1) { 
-        // Lock the mutex to safely modify shared data structures
-        status = pthread_mutex_lock (&alarm_mutex);
-        if (status != 0)
-            err_abort (status, "Lock mutex");
-        
-        //Initialize values before traversing
-        prev = NULL;
-        current = alarm_list;
-        now = time(NULL);
-        expired_count = 0;
+    status = pthread_create(&thread, NULL, pipe_reader_thread, NULL);
+    if (status != 0) {err_abort(status, "Create reader thread");}
+    for (int i = 0; i < pipe_workers; i++) {
+        status = pthread_create(&thread, NULL, pipe_parser_thread, NULL);
+        if (status != 0) {err_abort(status, "Create parser thread");}
+    }
 
-        //Traverse through the alarm list
-        while(current != NULL){
-            
-            //Find the expired alarm
-            if(current->time <= now){
-                //Expired alarm - print expiration message and remove the list
-                printf("Alarm(%d): Alarm Expired at %ld: Alarm Removed From Alarm List\n", alarm -> seconds, time(NULL));
-
-                //Remove expired alarm from the list
-                if(prev == NULL){
-                    alarm_list = current->link;
-                }else{
-                    prev->link = current->link;
-                }
-                
-                //Store expired alarm and free them later
-                if(expired_count < 50){
-                    expired_alarms[expired_count++] = current;
-                }
+    while (1) {
+        status = engine_lock(&pipe_mutex);
+        if (status != 0) {err_abort(status, "Lock pipeline mutex");}
+        chunk_t *chunk;
+        while ((chunk = pipe_parsed[pipe_next_apply % PIPE_WINDOW]) == NULL
+                && pipe_next_apply != pipe_read_total) {
+            status = pthread_cond_wait(&pipe_apply_cond, &pipe_mutex);
+            if (status != 0) {err_abort(status, "Wait for pipeline");}
+        }
+        status = engine_unlock(&pipe_mutex);
+        if (status != 0) {err_abort(status, "Unlock pipeline mutex");}
+        if (chunk == NULL)
+            return;
 
-            } else if(!current->is_assigned){
-                //Assign only active, unassigned alarm to the display thread
-                assign_alarm_to_display_thread(current);
-                current->is_assigned = 1;
-                prev = current;
-                current = current->link;
-            } else {
-                //Skip already assigned active alarms
-                prev = current;
-                current = current->link;
-            }
-            //Exit the thread after finish traversing the list
-            if (current == NULL) {
-                pthread_exit(NULL);
-            }
+        for (int i = 0; i < chunk->count; i++) {
+            int result = chunk->valid[i] ? apply_command(&chunk->commands[i]) : -2;
+            if (chunk->tags[i] >= 0)
+                ack_post(chunk->tags[i], result, &chunk->commands[i]);
         }
-        // Handle reassignment if alarm type change
-        for(int i = 0; i < display_thread_count; i++){
-            display_t *display = display_threads[i];
-            for(int j = 0; j < 2; j++){
-                alarm_t *assign_alarm = display->assigned_alarm[j];
 
-                if(assign_alarm && strcmp(assign_alarm->type, display->type) != 0){
-                    //If alarm type has changed, remove it from the current thread
-                    printf("Alarm (%d) Changed Type; Display Thread (%lu) Stopped Printing Alarm Message at %ld: %s %d %s\n", assign_alarm->alarm_ID, display->threadid, time(NULL), assign_alarm->type, assign_alarm->seconds, assign_alarm->message);
-                    display->assigned_alarm[j] = NULL;
-                    display->assigned_alarm_count--;
+        status = engine_lock(&pipe_mutex);
+        if (status != 0) {err_abort(status, "Lock pipeline mutex");}
+        pipe_parsed[pipe_next_apply % PIPE_WINDOW] = NULL;
+        pipe_next_apply++;
+        status = pthread_cond_signal(&pipe_read_cond);
+        if (status != 0) {err_abort(status, "Signal pipeline");}
+        status = engine_unlock(&pipe_mutex);
+        if (status != 0) {err_abort(status, "Unlock pipeline mutex");}
 
-                    //Reassign Alarm as if it were new
-                    assign_alarm_to_display_thread(assign_alarm);
-                }
-            }
-        }
+        free(chunk->commands);
+        free(chunk->tags);
+        free(chunk->valid);
+        free(chunk);
+    }
+}
 
-        /*
-         * Unlock the mutex before waiting, so that the main
-         * thread can lock it to insert a new alarm request. If
-         * the sleep_time is 0, then call sched_yield, giving
-         * the main thread a chance to run if it has been
-         * readied by user input, without delaying the message
-         * if there's no input.
-         */
-        status = pthread_mutex_unlock (&alarm_mutex);
-        if (status != 0)
-            err_abort (status, "Unlock mutex");
-        
-        // Process expired alarms outside of the mutex lock
-        for (int i = 0; i < expired_count; i++) {
-            alarm_t *expired_alarm = expired_alarms[i];
-            
-            // Free the expired alarm memory here
-            free(expired_alarm);
+/*
+ * End of input: drain what is still in flight, then exit.
+ */
+void finish_input (void) {
+    int status;
+
+    if (ack_target != NULL)
+        ack_drain();
+
+    /*
+     * On the virtual clock, end of input does not end the
+     * simulation: keep letting time run until every alarm
+     * has expired and every display thread has terminated.
+     */
+    while (clock_ops == &virtual_clock) {
+        int busy = 0;
+        for (int i = 0; i < atomic_load(&tenant_count); i++) {
+            tenant_t *tenant = tenants[i];
+            status = engine_lock (&tenant->alarm_mutex);
+            if (status != 0) {err_abort (status, "Lock mutex");}
+            busy |= tenant->scanning || tenant->hot_count > 0 || tenant->incoming_count > 0 || tenant->display_thread_count > 0 || tenant->cold_count > 0;
+            status = engine_lock (&tenant->executor_mutex);
+            if (status != 0) {err_abort (status, "Lock executor mutex");}
+            busy |= tenant->executing;
+            status = engine_unlock (&tenant->executor_mutex);
+            if (status != 0) {err_abort (status, "Unlock executor mutex");}
+            status = engine_unlock (&tenant->alarm_mutex);
+            if (status != 0) {err_abort (status, "Unlock mutex");}
         }
+        if (!busy) break;
+        clock_sleep(1);
+    }
 
-        //Sleep briefly before re-checking the alarm list
-        sleep(1);
+    /*
+     * Shared memory clients keep the engine alive after
+     * stdin is closed, until it is told to stop.
+     */
+    if (shm_name != NULL) {
+        clock_thread_exit();
+        while (!shm_stop)
+            pause ();
     }
+    channel_drain ();
+    exit (0);
 }
 
 int main (int argc, char *argv[]) {
     //Intialize variables and counters
-    int status;
     char line[256];     // Increased the buffer for command parsing (Arthi S)
-    alarm_t *alarm, **last, *next;
-    pthread_t thread;
+    command_t cmd;
+    size_t length;
+    int overload_given = 0;
+    int opt;
 
-    //Create new thread
-    status = pthread_create (&thread, NULL, alarm_thread, NULL);
-    if (status != 0) {err_abort (status, "Create alarm thread");}
+    /*
+     * Command line options:
+     *   -v        run on the virtual clock (see clock_ops_t)
+     *   -s name   also accept commands from the shared memory ring
+     *             "name" (see alarm_shm.h)
+     *   -R addr   replicate to a follower connecting to addr
+     *   -F addr   run as a follower of the primary at addr, taking
+     *             over when it goes away
+     *   -q        no prompt, and View_Alarms output ends with a line
+     *             "End View Alarms" (for programs such as alarm_router)
+     *   -P target pipelined mode, acknowledging "@SEQ" commands on target
+     *   -j n      bulk ingestion: read, parse (on n threads) and apply
+     *             in separate stages, with no prompt or pause
+     *   -H        report the handle of each new alarm, for use as
+     *             Change_Alarm(#handle) and Cancel_Alarm(#handle)
+     *   -D        the engine assigns alarm IDs: "Start_Alarm(): ..."
+     *   -Q pending[:displays]
+     *             per-tenant quotas on pending alarms and display threads
+     *   -T horizon[:partition]
+     *             keep alarms due beyond horizon seconds in the cold
+     *             tier, paged in partition seconds at a time
+     *   -C store  the cold tier: "mem" (the default) keeps cold alarms
+     *             compressed in memory, otherwise the partition files
+     *             go in the directory store
+     *   -B interval[:checks]
+     *             move alarms between half-empty displays of a type
+     *             every interval seconds (0 for never), once the
+     *             type has been sparse on checks looks in a row
+     */
+    while ((opt = getopt (argc, argv, "vs:R:F:qP:j:HDQ:T:C:B:O:W:K:U:")) != -1) {
+        switch (opt) {
+        case 'v':
+            clock_ops = &virtual_clock;
+            break;
+        case 's':
+            shm_name = optarg;
+            break;
+        case 'R':
+            repl_address = optarg;
+            break;
+        case 'F':
+            follow_address = optarg;
+            break;
+        case 'q':
+            //Line buffered, so a program reading our output sees each line as it is printed
+            quiet = 1;
+            setvbuf (stdout, NULL, _IOLBF, 0);
+            break;
+        case 'P':
+            ack_target = optarg;
+            break;
+        case 'j':
+            pipe_workers = atoi (optarg);
+            if (pipe_workers < 1) pipe_workers = 1;
+            break;
+        case 'H':
+            show_handles = 1;
+            break;
+        case 'D':
+            dense_ids = 1;
+            break;
+        case 'Q':
+            quota_pending = atoi (optarg);
+            if (strchr (optarg, ':') != NULL)
+                quota_displays = atoi (strchr (optarg, ':') + 1);
+            if (quota_displays < 1 || quota_displays > 10) quota_displays = 10;
+            break;
+        case 'T':
+            cold_horizon = atol (optarg);
+            cold_partition = strchr (optarg, ':') != NULL ? atol (strchr (optarg, ':') + 1) : cold_horizon / 4;
+            if (cold_partition < 1) cold_partition = 1;
+            break;
+        case 'C':
+            cold_store = optarg;
+            break;
+        case 'B':
+            rebalance_interval = atoi (optarg);
+            if (strchr (optarg, ':') != NULL)
+                rebalance_checks = atoi (strchr (optarg, ':') + 1);
+            if (rebalance_checks < 1) rebalance_checks = 1;
+            break;
+        case 'O':
+            channel_dir = optarg;
+            if (strchr (optarg, ':') != NULL) {
+                if (atol (strchr (optarg, ':') + 1) > 0)
+                    channel_limit = atol (strchr (optarg, ':') + 1);
+                *strchr (optarg, ':') = '\0';
+            }
+            break;
+        case 'W':
+            if (strcmp (optarg, "coalesce") == 0)
+                overload_policy = OVERLOAD_COALESCE;
+            else if (strcmp (optarg, "drop") == 0)
+                overload_policy = OVERLOAD_DROP;
+            else if (strcmp (optarg, "block") == 0)
+                overload_policy = OVERLOAD_BLOCK;
+            else {
+                fprintf (stderr, "Unknown overload policy %s\n", optarg);
+                exit (1);
+            }
+            overload_given = 1;
+            break;
+        case 'K':
+            //The whole policy word, up to the optional ":limit"
+            length = strcspn (optarg, ":");
 
-    while (1) {
+            if (length == 4 && strncmp (optarg, "once", 4) == 0)
+                catchup_policy = CATCHUP_ONCE;
+            else if (length == 3 && strncmp (optarg, "all", 3) == 0)
+                catchup_policy = CATCHUP_ALL;
+            else if (length == 4 && strncmp (optarg, "skip", 4) == 0)
+                catchup_policy = CATCHUP_SKIP;
+            else {
+                fprintf (stderr, "Unknown catch-up policy %s\n", optarg);
+                exit (1);
+            }
+            if (optarg[length] == ':')
+                catchup_limit = atoi (optarg + length + 1);
+            if (catchup_limit < 0) catchup_limit = 0;
+            break;
+        case 'U':
+            alarm_quantum = atoi (optarg);
+            if (alarm_quantum < 0) alarm_quantum = 0;
+            break;
+        default:
+            fprintf (stderr, "Usage: %s [-v] [-q] [-s shm_name] [-R address] [-F address] [-P ack_target] [-j workers] [-H] [-D] [-Q pending[:displays]] [-T horizon[:partition] [-C mem|dir]] [-B interval[:checks]] [-O dir[:limit] [-W coalesce|drop|block]] [-K once|all|skip[:limit]] [-U records]\n", argv[0]);
+            exit (1);
+        }
+    }
+    //The overload policy applies to channels only: stdout is written by the thread that printed
+    if (overload_given && channel_dir == NULL) {
+        fprintf (stderr, "-W needs -O: the overload policy applies to output channels\n");
+        exit (1);
+    }
 
-        printf ("alarm> ");
-        if (fgets (line, sizeof (line), stdin) == NULL) exit (0);
-        if (strlen (line) <= 1) continue;
-        
-        /* Truncate message if it exceeds 128 characters (Arthi S)
-         * Ensures no overflow in error messages, truncates if necessary, 
-         * and warns user if message was truncated.
-         */
-        if (strlen(line) > 128){
-            line[127] = '\0';
-            fprintf(stderr, "WARNING: Message trunated to 128 characters.\n");
+    //Output channels must be creatable now, not on the first typed line; a reader going away must not kill the engine
+    if (channel_dir != NULL) {
+        if (access (channel_dir, W_OK | X_OK) != 0) {
+            fprintf (stderr, "Cannot write output channels in %s: %s\n", channel_dir, strerror (errno));
+            exit (1);
         }
+        signal (SIGPIPE, SIG_IGN);
+    }
+    if (cold_horizon > 0)
+        cold_ops = cold_store == NULL || strcmp (cold_store, "mem") == 0 ? &mem_cold : &disk_cold;
 
-        // Variables used in command parsing (Arthi S)
-        char command[16];
-        int alarm_id;
-        char type[3];
-        int alarm_duration;
-        char message[128];
+    //The cold tier's directory must be usable now, not at the first spill
+    if (cold_ops == &disk_cold) {
+        if ((mkdir (cold_store, 0700) != 0 && errno != EEXIST) || access (cold_store, W_OK | X_OK) != 0) {
+            fprintf (stderr, "Cannot write cold partitions in %s: %s\n", cold_store, strerror (errno));
+            exit (1);
+        }
+    }
 
-        /* Parse and validate command input (Arthi S)
-         * Extracts the command, alarm ID, type, time, and message by parsing the command.
-         * Ensures the proper formatting and validity of commands.
-         */
-        if (sscanf (line, "%[^(](%d): %s %d %128[^\n]", command, &alarm_id, type, &alarm_duration, message) > 0) {
-            if (strcmp(command, "Start_Alarm") == 0) {
-                /* Start_Alarm command handling
-                * Allocates memory for new alarm, sets time & message,
-                * and inserts it into the sorted list
-                */
-                alarm = (alarm_t *)malloc(sizeof(alarm_t));
-                if (alarm == NULL) {errno_abort("Allocate alarm");}
-                
-                alarm -> seconds = alarm_duration;
-                strncpy(alarm -> message, message, sizeof(alarm -> message) - 1);
-                alarm -> message[127] = '\0';   // Ensures null termination
-                alarm -> time = time(NULL) + alarm -> seconds;
-                strncpy(alarm->type, type, sizeof(alarm->type) - 1);
-                alarm->alarm_ID = alarm_id;
-                alarm->is_assigned = 0;
-
-                /* Locks mutex for thread safe insertion
-                * Lock ensures that only one thread can modify the alarm_list
-                * at any given time (prevents race conditions during insertion)
-                */
-                status = pthread_mutex_lock(&alarm_mutex);
-                if (status != 0) {err_abort(status, "Lock mutex");}
-                
-                /*
-                * Insert the new alarm into the list of alarms, sorted by expiration time.
-                */
-                last = &alarm_list;
-                next = *last;
-
-                while (next != NULL){
-                    if (next->alarm_ID >= alarm->alarm_ID){     ///Sorted by their IDs
-                        alarm -> link = next;
-                        *last = alarm;
-                        break;
-                    }
-                    last = &next -> link;
-                    next = next -> link;
-                }
-                /*
-                * If we reached the end of the list, insert the new
-                * alarm there. ("next" is NULL, and "last" points
-                * to the link field of the last item, or to the
-                * list header).
-                */
-                if (next == NULL){
-                    *last = alarm;
-                    alarm -> link = NULL;
-                }
+    deadline_scan = deadline_scan_select (NULL);
+    clock_init();
 
-                // Unlock mutex post-insert so other threads can access/modify alarm_list
-                status = pthread_mutex_unlock(&alarm_mutex);
-                if (status != 0) {err_abort(status, "Unlock mutex");}
-                printf("Alarm(%d) Inserted by Main Thread (%lu) Into Alarm List at %ld: %s %d %s\n", alarm_id, thread, time(NULL), type, alarm_duration, message);
-                //pthread_self(), time(NULL), type, alarm_duration, time(NULL), alarm -> message);
-
-            } else if (strcmp(command, "Change_Alarm") == 0) {
-                /* Change_Alarm command handling
-                * Locks the mutex, finds + updates alarm using specified ID,
-                * and unlocks after modification
-                */
-                status = pthread_mutex_lock (&alarm_mutex);
-                if (status != 0) {err_abort (status, "Lock mutex");}
-                
-                alarm = alarm_list;
+    if (follow_address != NULL)
+        follow_primary();
 
-                while (alarm != NULL){
-                    if (alarm->alarm_ID == alarm_id){
-                        alarm -> seconds = alarm_duration;
-                        strncpy(alarm -> message, message, sizeof(alarm -> message) - 1);
-                        printf("Alarm(%d) Changed at %ld: %s %d %s\n", alarm_id, time(NULL), type, alarm_duration, message);
-                        break;
-                    }
-                    alarm = alarm -> link;
-                }
-                
-                if (alarm == NULL){
-                    fprintf(stderr, "ERROR: Alarm ID %d not found for modification.\n", alarm_id);
-                }
-                status = pthread_mutex_unlock(&alarm_mutex);
-                if (status != 0) {err_abort(status, "Unlock mutex");}
-
-            } else if (strcmp(command, "Cancel_Alarm") == 0) {
-                /* Cancel_Alarm command handling
-                * Locks mutex, finds specified alarm using ID,
-                * removes from list if found, then unlocks mutex
-                */
-                status = pthread_mutex_lock(&alarm_mutex);
-                if(status != 0) {err_abort(status, "Lock mutex");}
-
-                last = &alarm_list;
-                alarm = *last;
-
-                while (alarm != NULL){
-                    if (alarm->alarm_ID == alarm_id){
-                        *last = alarm -> link;
-                        free(alarm);
-                        printf("Alarm(%d) Cancelled at %ld: %s %d %s\n", alarm_id, time(NULL), type, alarm_duration, message);
-                        cancel_alarm_in_display_thread(alarm);
-                        break;
-                    }
-                    last = &alarm -> link;
-                    alarm = *last;
-                }
+    //The main thread drives the clock, and so does each tenant's alarm thread
+    clock_thread_start();
 
-                if (alarm == NULL){
-                    fprintf(stderr, "ERROR: Alarm ID %d not found for cancellation.\n", alarm_id);
-                }
-                status = pthread_mutex_unlock(&alarm_mutex);
-                if (status != 0) {err_abort(status, "Unlock mutex");}
-            } else if (strcmp(line, "View_Alarms\n") == 0) {
-                /* View_Alarm command handling
-                * Locks mutex, iterates through alarm_list to display all active alarms
-                * (ensures thread-safe access), then unlocks mutex
-                */
-                status = pthread_mutex_lock(&alarm_mutex);
-                if(status != 0) {err_abort(status, "Lock mutex");}
-                printf("View Alarms at %ld:\n", time(NULL));
-
-                //If alarm list is empty
-                if (alarm_list == NULL) {
-                    printf("Alarm list is empty.\n");
-
-                //Print if it is not empty
-                } else {
-                    //Displaying the alarm
-                    for(int i = 0; i < display_thread_count; i++){
-                        display_t *temp_display = display_threads[i];
-                        printf("%d. Display Thread %lu Assigned:\n", i, temp_display->threadid);
-
-                        for(int k = 0; k < temp_display->assigned_alarm_count; k++){
-                            alarm_t *temp_alarm = temp_display->assigned_alarm[k];
-                            printf("\t%d%c. Alarm(%d): %s %d %s\n", i + 1, k + 97, alarm_id, type, alarm_duration, message);
-                        }
-                    }
-                }
-                // Unlock the mutex after modifying shared data structures 
-                status = pthread_mutex_unlock(&alarm_mutex);
-                if (status != 0) {err_abort(status, "Unlock mutex");}
-            } else{
-            fprintf(stderr, "ERROR: Invalid command %s\n", command);
-            }
-#ifdef DEBUG
-            printf ("[list: ");
-            for (next = alarm_list; next != NULL; next = next->link)
-                printf ("%d(%d)[\"%s\"] ", next->time,
-                    next->time - time (NULL), next->message);
-            printf ("]\n");
-#endif
-            // Unlock the mutex after modifying shared data structures
-            status = pthread_mutex_unlock (&alarm_mutex);
-            if (status != 0)
-                err_abort (status, "Unlock mutex");
+    //Create the default tenant, and start the alarm threads
+    tenant_find ("default", 1);
+    tenant_start_all ();
+
+    if (shm_name != NULL)
+        shm_start();
+    if (repl_address != NULL)
+        repl_start();
+    if (ack_target != NULL)
+        ack_start();
+
+    if (pipe_workers > 0) {
+        run_pipeline ();
+        finish_input ();
+    }
+
+    while (1) {
+
+        if (!quiet && ack_target == NULL)
+            output ("alarm> ");
+        if (fgets (line, sizeof (line), stdin) == NULL)
+            finish_input ();
+        if (strlen (line) <= 1) continue;
+
+        //Pipelined commands may be tagged "@SEQ Command"
+        char *text = line;
+        long sequence = -1;
+        if (ack_target != NULL && line[0] == '@') {
+            sequence = strtol (line + 1, &text, 10);
+            while (*text == ' ')
+                text++;
         }
-        //Sleep briefly before re-prompting
-        sleep(2);
+
+        int result = -2;
+        if (parse_command (text, &cmd) == 0)
+            result = apply_command (&cmd);
+        if (sequence >= 0)
+            ack_post (sequence, result, &cmd);
+
+        //Sleep briefly before re-prompting (not in pipelined or quiet mode)
+        if (ack_target == NULL && !quiet)
+            clock_sleep(2);
     }
 }